@@ -0,0 +1,58 @@
+"""
+This file contains the command to emulate a FPGA running the LitexCNC firmware, based on
+a JSON-configuration.
+"""
+import click
+
+
+@click.command()
+@click.argument('config', type=click.File('r'))
+@click.option('-a', '--address', default='127.0.0.1', help="The address the emulator listens on.")
+@click.option('-p', '--port', default=1234, help="The port the emulator listens on.")
+@click.option('--reply-port', type=int, help="The port the responses are sent to (default: same as --port).")
+@click.option('--latency', default=0.0, help="Latency added to each response in microseconds.")
+@click.option('--jitter', default=0.0, help="Random latency (0 up to this value) added to each response in microseconds.")
+@click.option('--loss', default=0.0, help="Fraction of the responses which is dropped (0.0 - 1.0).")
+@click.option('--gpio-loopback', is_flag=True, help="Reflect the GPIO outputs on the GPIO inputs.")
+@click.option('--seed', type=int, help="Seed for the random latency and loss.")
+def cli(config, address, port, reply_port, latency, jitter, loss, gpio_loopback, seed):
+    """Emulates a FPGA with the given configuration on an Etherbone connection"""
+    from litexcnc.firmware.soc import LitexCNC_Firmware
+    from litexcnc.config.connections import EtherboneConnection
+    from litexcnc.tools.emulator import EmulatedFPGA, EtherboneServer
+
+    # Load configuration
+    firmware_config = LitexCNC_Firmware.parse_raw(' '.join(config.readlines()))
+    connections = firmware_config.connection
+    if not isinstance(connections, list):
+        connections = [connections]
+    burst_read = any(
+        connection.burst_read
+        for connection in connections
+        if isinstance(connection, EtherboneConnection)
+    )
+
+    try:
+        fpga = EmulatedFPGA(firmware_config, gpio_loopback=gpio_loopback)
+    except TypeError as e:
+        click.echo(click.style("Error", fg="red") + f": {e}")
+        return -1
+    server = EtherboneServer(
+        fpga,
+        address=address,
+        port=port,
+        reply_port=reply_port,
+        latency_us=latency,
+        jitter_us=jitter,
+        loss=loss,
+        burst_read=burst_read,
+        seed=seed
+    )
+    click.echo(click.style("INFO", fg="blue") + f": Emulating {firmware_config.board_name} on {address}:{port}, press Ctrl-C to stop.")
+    try:
+        server.serve()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.close()
+    click.echo(click.style("INFO", fg="blue") + f": Received {server.packets_received} packets, sent {server.packets_sent} responses, dropped {server.packets_dropped} responses.")
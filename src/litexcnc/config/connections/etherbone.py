@@ -20,6 +20,7 @@ class EtherboneConnection(BaseModel):
     driver_files: ClassVar[List[str]] = [
         os.path.dirname(__file__) + '/../../../driver/boards/litexcnc_eth.c',
         os.path.dirname(__file__) + '/../../../driver/boards/litexcnc_eth.h',
+        os.path.dirname(__file__) + '/../../../driver/boards/litexcnc_ethraw.c',
         os.path.dirname(__file__) + '/../../../driver/boards/etherbone.c',
         os.path.dirname(__file__) + '/../../../driver/boards/etherbone.h'
     ]
@@ -46,6 +47,21 @@ class EtherboneConnection(BaseModel):
         "192.168.0.50",
         help_text="The ip-address to communicate with the FPGA-card."
     )
+    buffer_depth: int = Field(
+        255,
+        help_text="The depth (in words) of the buffers of the Etherbone core. When the "
+        "driver uses the combined transfer mode (``transfer=combined``), a single record "
+        "contains both the write data and the addresses to read. In that case the buffer "
+        "depth must be at least the number of words written plus the number of words read "
+        "plus one."
+    )
+    burst_read: bool = Field(
+        False,
+        help_text="Adds support for burst reads to the Etherbone core. A burst read "
+        "requests a number of consecutive words with a single address, which reduces "
+        "the size of the read request to 20 bytes. The driver only uses burst reads "
+        "when the option ``burst=1`` is given in the connection string."
+    )
 
     @validator('mac_address', pre=True)
     def convert_mac_address(cls, value):
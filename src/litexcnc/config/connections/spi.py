@@ -41,3 +41,10 @@ class SPIboneConnection(BaseModel):
         "LVCMOS33",
         description="The IO Standard (voltage) to use for the pin."
     )
+    crc: bool = Field(
+        False,
+        description="Adds support for CRC-protected commands to the SPI bridge. Writes "
+        "of which the CRC is incorrect are rejected, reads are followed by the CRC of "
+        "the data. The driver only uses the CRC when the option ``crc=1`` is given in "
+        "the connection string."
+    )
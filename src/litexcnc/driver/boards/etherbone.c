@@ -14,18 +14,88 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h> 
+#include <time.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define EB_HAVE_IO_URING 1
+#endif
+#endif
+
+// Socket options for busy polling, not defined in older versions of the headers
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
 
 #include "etherbone.h"
 #include "litexcnc.h"
 
-//#define TIME_ETHERBONE
-#ifdef TIME_ETHERBONE
-#include <time.h>
-uint32_t loops_read;
-uint32_t loops_write;
-struct timespec begin, end;
-uint32_t create_packet = 0, send_adresses = 0, receive_data = 0, unpack_data = 0;
+// Settings for the raw Ethernet transport (see `eb_connect_raw`)
+#define EB_RAW_HEADER_SIZE  42    // Ethernet (14) + IPv4 (20) + UDP (8)
+#define EB_RAW_FRAME_SIZE   2048  // Size of a frame in the rings (header + data)
+#define EB_RAW_BLOCK_SIZE   4096  // Size of a block in the rings (must be a multiple of page size)
+#define EB_RAW_RX_FRAMES    64
+#define EB_RAW_TX_FRAMES    16
+
+// Settings for the io_uring transport (see `eb_setup_io_uring`)
+#define EB_URING_ENTRIES     64
+#define EB_URING_MAX_IOV     4
+#define EB_URING_MAX_BUFFERS 16
+#define EB_URING_SQ_THREAD_IDLE_MS 1000
+#define EB_URING_TAG_SEND    1
+#define EB_URING_TAG_RECV    2
+#define EB_URING_TAG_TIMEOUT 3
+#define EB_URING_TAG_CANCEL  4
+
+#ifdef EB_HAVE_IO_URING
+struct eb_uring {
+    int fd;
+    int sqpoll;
+    // Submission queue
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;   // Tail including the entries which are not submitted yet
+    unsigned unsubmitted;     // Number of entries queued since the last submission
+    struct io_uring_sqe *sqes;
+    struct io_uring_sqe *last_send; // Last packet queued, linked to the next receive
+    struct iovec iov[EB_URING_ENTRIES][EB_URING_MAX_IOV];
+    // Completion queue
+    void *cq_ring;
+    size_t cq_ring_size;      // Zero when the completion queue shares the mapping
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Registered buffers
+    struct iovec buffers[EB_URING_MAX_BUFFERS];
+    int num_buffers;
+    struct __kernel_timespec timeout;
+    uint64_t recv_tag;        // EB_URING_TAG_RECV with the number of the receive in bits 8 and up
+    unsigned send_errors;     // Packets of which the send has failed (see `eb_take_send_errors`)
+};
+#else
+struct eb_uring;
 #endif
 
 struct eb_connection {
@@ -33,82 +103,346 @@ struct eb_connection {
     int read_fd;
     int is_direct;
     struct addrinfo* addr;
+    struct timespec last_tx;  // Moment the last packet has been sent (CLOCK_MONOTONIC)
+    // Raw Ethernet transport (see `eb_connect_raw`)
+    int is_raw;
+    uint8_t *ring;            // Memory mapped Rx ring, directly followed by the Tx ring
+    size_t ring_size;
+    size_t rx_ring_size;
+    unsigned int rx_frame;    // Index of the next frame to be received
+    unsigned int tx_frame;    // Index of the next frame to be sent
+    uint8_t frame_header[EB_RAW_HEADER_SIZE]; // Template for the Ethernet, IPv4 and UDP headers
+    uint32_t remote_ip;       // IP-address of the board (network order)
+    uint16_t remote_port;     // UDP-port of the board (network order)
+    uint16_t ip_id;
+    // io_uring transport (see `eb_setup_io_uring`), NULL when the sockets are used directly
+    struct eb_uring *uring;
+    long recv_timeout_ns;
+    // Timestamping of the packets (see `eb_enable_timestamping`)
+    int timestamping;
+    uint32_t tx_count;           // Number of packets sent since timestamping was enabled
+    struct timespec rx_software; // Timestamps of the last packet received
+    struct timespec rx_hardware;
+    char hwtstamp_ifname[IFNAMSIZ];         // Interface of which the hardware timestamping has been
+    struct hwtstamp_config hwtstamp_saved;  // changed, and its configuration to restore on disconnect
 };
 
 
-unsigned long timestampUsec()  // this can roll over! for debug only
-{
-	struct timeval timestamp;
-	
-	gettimeofday(&timestamp, NULL);
-	
-	return(timestamp.tv_sec * 1000000 + ( timestamp.tv_usec));
+// Helpers for calculating with timestamps of the monotonic clock
+static void eb_timespec_add_ns(struct timespec *ts, long ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec++;
+    }
 }
 
-// sleep for some microseconds.
-// this method will allow for rescheduling
-void usecSleep(long usec) {
-    long ts1=timestampUsec();
-	
-	struct timeval tv;
-	tv.tv_sec = 0;
-	tv.tv_usec = usec;
-	select(0, NULL, NULL, NULL, &tv);
-	
-    long ts2=timestampUsec();
-    long dura = ts2 - ts1; // can roll...
-    if ( dura > 0 && dura > usec + 100) {
-	    fprintf(stderr, "colorcnc debug: overslept %ld instad of %ld usec\n", dura, usec);
-    }
+static long eb_timespec_diff_ns(const struct timespec *end, const struct timespec *start) {
+    return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
 }
 
 
-void eb_wait_for_tx_buffer_empty(struct eb_connection *conn) {
-    int tx_queue_len = 0, first = 1;
-    int tx_queue_max_len = 0;
-    int peekCount = 0;
-    // long time1 = timestampUsec();
-    
-    while ( first || tx_queue_len > 0) {
-	    if (tx_queue_len > 0) {
-            usecSleep(10);
-            // fprintf(stderr, "Queue length: %d \n", tx_queue_len);
-        }
-	    int rc = ioctl(conn->fd, TIOCOUTQ, &tx_queue_len);
-	    if ( rc < 0) {
-		    perror("colorcnc: cannot ioctl?");
-		    exit(1);
-	    }
-	    if ( tx_queue_len > tx_queue_max_len ) tx_queue_max_len = tx_queue_len;
-	    first = 0;
-	    ++peekCount;
+/*******************************************************************************
+ * Waits until the minimum gap between two packets has passed since the previous
+ * packet has been sent. This is essential as the colorlight card crashes when two
+ * packets come close to each other. Only the remaining part of the gap is slept,
+ * using an absolute deadline on the monotonic clock, so the wait does not depend
+ * on the granularity of the scheduler.
+ *
+ * @param conn   The connection on which the next packet will be sent.
+ * @param gap_ns The minimum time between two packets in nanoseconds.
+ * @return The time waited in nanoseconds.
+ ******************************************************************************/
+long eb_wait_for_packet_gap(struct eb_connection *conn, long gap_ns) {
+    struct timespec now, deadline, end;
+
+    // Packets queued in the io_uring are sent first, the gap starts when they are sent
+    eb_flush(conn);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = conn->last_tx;
+    eb_timespec_add_ns(&deadline, gap_ns);
+
+    // No need to wait when the gap has already passed
+    if (eb_timespec_diff_ns(&deadline, &now) <= 0) {
+        return 0;
     }
-    
-    // long time2 = timestampUsec();
-    // long dura = time2 - time1;
-    // if (dura > 300) {
-	//     fprintf(stderr, "colorcnc debug: waited for socket tx_queue to clear for %ld usec, %d samples, max len %d\n", dura, peekCount, tx_queue_max_len);
-    // }
-    
+
+    // Sleep for the remainder of the gap (resumes when interrupted by a signal)
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return eb_timespec_diff_ns(&end, &now);
 }
 
 
+static int eb_raw_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt);
+static int eb_raw_recv(struct eb_connection *conn, void *bytes, size_t max_len, long timeout_ns);
+#ifdef EB_HAVE_IO_URING
+static int eb_uring_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt);
+static int eb_uring_recv(struct eb_connection *conn, void *bytes, size_t max_len, int spin);
+#endif
+static void eb_close_io_uring(struct eb_connection *conn);
+static int eb_recv_timestamped(struct eb_connection *conn, void *bytes, size_t max_len, int flags);
+
 int eb_send(struct eb_connection *conn, const void *bytes, size_t len) {
-    if (conn->is_direct)
-        return sendto(conn->fd, bytes, len, 0, conn->addr->ai_addr, conn->addr->ai_addrlen);
-    return write(conn->fd, bytes, len);
+    int r;
+#ifdef EB_HAVE_IO_URING
+    // The moment the packet is sent is recorded when it is submitted
+    if (conn->uring) {
+        struct iovec iov = {.iov_base = (void *) bytes, .iov_len = len};
+        return eb_uring_sendv(conn, &iov, 1);
+    }
+#endif
+    if (conn->is_raw) {
+        struct iovec iov = {.iov_base = (void *) bytes, .iov_len = len};
+        r = eb_raw_sendv(conn, &iov, 1);
+    } else if (conn->is_direct)
+        r = sendto(conn->fd, bytes, len, 0, conn->addr->ai_addr, conn->addr->ai_addrlen);
+    else
+        r = write(conn->fd, bytes, len);
+    clock_gettime(CLOCK_MONOTONIC, &conn->last_tx);
+    if (r >= 0) {
+        conn->tx_count++;
+    }
+    return r;
 }
 
 
 int eb_recv(struct eb_connection *conn, void *bytes, size_t max_len) {
+#ifdef EB_HAVE_IO_URING
+    if (conn->uring)
+        return eb_uring_recv(conn, bytes, max_len, 0);
+#endif
+    if (conn->is_raw)
+        return eb_raw_recv(conn, bytes, max_len, conn->recv_timeout_ns);
+    if (conn->timestamping)
+        return eb_recv_timestamped(conn, bytes, max_len, 0);
     if (conn->is_direct)
         return recvfrom(conn->read_fd, bytes, max_len, 0, NULL, NULL);
     return read(conn->fd, bytes, max_len);
 }
 
 
-int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t size, bool debug) {
-    // Create a buffer for the header (16 bytes) + maximum payload size (255). The header of the etherbone
+/*******************************************************************************
+ * Enables busy polling on the receiving socket. When busy polling, the kernel
+ * polls the network card for new packets when the socket is read, instead of
+ * waiting for the interrupt of the network card.
+ *
+ * @param conn The connection.
+ * @param usec The time (in microseconds) the kernel polls the network card.
+ * @return 0 on success, -1 when busy polling could not be enabled.
+ ******************************************************************************/
+int eb_set_busy_poll(struct eb_connection *conn, int usec) {
+    // The raw transport polls the ring directly
+    if (conn->is_raw) {
+        return 0;
+    }
+    int fd = conn->is_direct ? conn->read_fd : conn->fd;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        return -1;
+    }
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Receives a packet by spinning on a non-blocking receive, until the response
+ * has arrived or the deadline has passed. After the deadline the (blocking)
+ * receive `eb_recv` is used. The deadline is relative to the moment the last
+ * packet has been sent. For the raw transport and io_uring, the time spent
+ * spinning is part of the timeout set with `eb_set_recv_timeout`.
+ *
+ * @param conn        The connection.
+ * @param bytes       Buffer to store the received data in.
+ * @param max_len     Size of the buffer.
+ * @param max_spin_ns The deadline for spinning, in nanoseconds after the last
+ * packet has been sent.
+ * @param spin_ns     The time spent spinning, in nanoseconds.
+ * @return The number of bytes received, or -1 on error.
+ ******************************************************************************/
+int eb_recv_spin(struct eb_connection *conn, void *bytes, size_t max_len, long max_spin_ns, long *spin_ns) {
+    struct timespec start, now, deadline;
+    int r;
+
+#ifdef EB_HAVE_IO_URING
+    // The completion of the receive is polled (SQPOLL only), until the timeout
+    if (conn->uring) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        r = eb_uring_recv(conn, bytes, max_len, 1);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *spin_ns = eb_timespec_diff_ns(&now, &start);
+        return r;
+    }
+#endif
+
+    deadline = conn->last_tx;
+    eb_timespec_add_ns(&deadline, max_spin_ns);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true) {
+        if (conn->is_raw)
+            r = eb_raw_recv(conn, bytes, max_len, 0);
+        else if (conn->timestamping)
+            r = eb_recv_timestamped(conn, bytes, max_len, MSG_DONTWAIT);
+        else if (conn->is_direct)
+            r = recvfrom(conn->read_fd, bytes, max_len, MSG_DONTWAIT, NULL, NULL);
+        else
+            r = recv(conn->fd, bytes, max_len, MSG_DONTWAIT);
+        if ((r >= 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (eb_timespec_diff_ns(&deadline, &now) <= 0) {
+            // Fall back to waiting for the response
+            if (conn->is_raw) {
+                long remaining_ns = conn->recv_timeout_ns - eb_timespec_diff_ns(&now, &start);
+                r = eb_raw_recv(conn, bytes, max_len, (remaining_ns > 0) ? remaining_ns : 0);
+            } else {
+                r = eb_recv(conn, bytes, max_len);
+            }
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *spin_ns = eb_timespec_diff_ns(&now, &start);
+    return r;
+}
+
+
+/*******************************************************************************
+ * Receives the first packet which arrives on any of the connections, for example
+ * when the same device is connected with redundant links. The connections must
+ * use UDP sockets (no raw transport, no io_uring). Also used for a single
+ * connection when the time to wait for the packet differs per call.
+ *
+ * @param conns       The connections.
+ * @param count       The number of connections.
+ * @param bytes       Buffer to store the received data in.
+ * @param max_len     Size of the buffer.
+ * @param max_spin_ns The deadline for spinning on non-blocking receives, in
+ * nanoseconds after the last packet has been sent on the first connection. When
+ * zero, the driver waits for the packet without spinning.
+ * @param timeout_ns  The time to wait for a packet, including the time spent
+ * spinning. When zero, only the packets already received are checked.
+ * @param index       The index of the connection the packet has been received on.
+ * @param spin_ns     The time spent in this function, in nanoseconds (optional).
+ * @return The number of bytes received, or -1 on error (errno EAGAIN when no
+ * packet has been received in time).
+ ******************************************************************************/
+int eb_recv_any(struct eb_connection **conns, int count, void *bytes, size_t max_len, long max_spin_ns, long timeout_ns, int *index, long *spin_ns) {
+    struct pollfd pfds[count];
+    struct timespec start, now, deadline, spin_deadline;
+    int r;
+
+    for (int i=0; i<count; i++) {
+        if (conns[i]->is_raw || conns[i]->uring) {
+            errno = EINVAL;
+            return -1;
+        }
+        pfds[i].fd = conns[i]->is_direct ? conns[i]->read_fd : conns[i]->fd;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+
+    // Spin on all connections until the spin deadline has passed, then wait for the
+    // first connection which has a packet. Spinning never continues past the timeout.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    eb_timespec_add_ns(&deadline, timeout_ns);
+    spin_deadline = conns[0]->last_tx;
+    eb_timespec_add_ns(&spin_deadline, max_spin_ns);
+    if (eb_timespec_diff_ns(&spin_deadline, &deadline) > 0) {
+        spin_deadline = deadline;
+    }
+    // All connections are checked once, so a packet which has already arrived is
+    // received even when the timeout has passed
+    bool check_all = true;
+    while (true) {
+        for (int i=0; i<count; i++) {
+            if (!check_all && !(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            if (conns[i]->timestamping)
+                r = eb_recv_timestamped(conns[i], bytes, max_len, MSG_DONTWAIT);
+            else
+                r = recv(pfds[i].fd, bytes, max_len, MSG_DONTWAIT);
+            if (r >= 0) {
+                *index = i;
+                goto done;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                goto done;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        check_all = eb_timespec_diff_ns(&spin_deadline, &now) > 0;
+        if (check_all) {
+            continue;
+        }
+        long remaining_ns = eb_timespec_diff_ns(&deadline, &now);
+        if (remaining_ns <= 0) {
+            errno = EAGAIN;
+            r = -1;
+            goto done;
+        }
+        struct timespec remaining = {.tv_sec = remaining_ns / 1000000000L, .tv_nsec = remaining_ns % 1000000000L};
+        for (int i=0; i<count; i++) {
+            pfds[i].revents = 0;
+        }
+        if ((ppoll(pfds, count, &remaining, NULL) < 0) && (errno != EINTR)) {
+            r = -1;
+            goto done;
+        }
+    }
+
+done:
+    if (spin_ns != NULL) {
+        int saved_errno = errno;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *spin_ns = eb_timespec_diff_ns(&now, &start);
+        errno = saved_errno;
+    }
+    return r;
+}
+
+
+int eb_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt) {
+    // Sends the fragments as a single packet, which prevents copying the fragments
+    // into one buffer before sending
+#ifdef EB_HAVE_IO_URING
+    if (conn->uring) {
+        return eb_uring_sendv(conn, iov, iovcnt);
+    }
+#endif
+    if (conn->is_raw) {
+        int r = eb_raw_sendv(conn, iov, iovcnt);
+        clock_gettime(CLOCK_MONOTONIC, &conn->last_tx);
+        return r;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+    if (conn->is_direct) {
+        msg.msg_name = conn->addr->ai_addr;
+        msg.msg_namelen = conn->addr->ai_addrlen;
+    }
+    int r = sendmsg(conn->fd, &msg, 0);
+    clock_gettime(CLOCK_MONOTONIC, &conn->last_tx);
+    if (r >= 0) {
+        conn->tx_count++;
+    }
+    return r;
+}
+
+
+static int eb_read8_record(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t size, bool debug) {
+    // Create a buffer for the header (16 bytes) + maximum payload size. The header of the etherbone
     // package consist of the following fields:
     // 0x00 = 0x4e;	     // Magic byte 0
     // 0x01 = 0x6f;	     // Magic byte 1
@@ -120,11 +454,11 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
     // 0x07 = 0;	 	 // Padding
     // 0x08 = 0;		 // No Wishbone flags are set (cyc, wca, wff, etc.)
     // 0x09 = 0x0f;	     // Byte enable
-    static uint8_t eth_pkt[16+255] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
-    static uint8_t response[16+255];
+    static uint8_t eth_pkt[16+4*EB_MAX_RECORD_WORDS] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
+    static uint8_t response[16+4*EB_MAX_RECORD_WORDS];
 
      // Clear data and write data to package
-    memset((void*) &eth_pkt[16], 0, 255);
+    memset((void*) &eth_pkt[16], 0, 4*EB_MAX_RECORD_WORDS);
     // - size
     size_t words = size >> 2;
     eth_pkt[11] = words; // Write count (in WORD-count, bitshift to divide by 4)
@@ -150,7 +484,7 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
     eb_send(conn, eth_pkt, 16+size);
 
     // Check response
-    memset((void*) response, 0, 16+255);
+    memset((void*) response, 0, 16+4*EB_MAX_RECORD_WORDS);
     int count = eb_recv(conn, response, 16+size);
     if (count != (16+size)) {
         fprintf(stderr, "Unexpected read length: %d, expected %zu\n", count, (16+size));
@@ -176,8 +510,8 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
 }
 
 
-void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data, size_t size, bool debug) {
-    // Create a buffer for the header (16 bytes) + maximum payload size (255). The header of the etherbone
+static void eb_write8_record(struct eb_connection *conn, uint32_t address, const uint8_t* data, size_t size, bool debug) {
+    // Create a buffer for the header (16 bytes) + maximum payload size. The header of the etherbone
     // package consist of the following fields:
     // 0x00 = 0x4e;	     // Magic byte 0
     // 0x01 = 0x6f;	     // Magic byte 1
@@ -189,10 +523,10 @@ void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data
     // 0x07 = 0;	 	 // Padding
     // 0x08 = 0;		 // No Wishbone flags are set (cyc, wca, wff, etc.)
     // 0x09 = 0x0f;	     // Byte enable
-    static uint8_t eth_pkt[16+255] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
+    static uint8_t eth_pkt[16+4*EB_MAX_RECORD_WORDS] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
     
     // Clear data and write data to package
-    memset((void*) &eth_pkt[16], 0, 255);
+    memset((void*) &eth_pkt[16], 0, 4*EB_MAX_RECORD_WORDS);
     // - size
     eth_pkt[10] = size >> 2; // Write count (in WORD-count, bitshift to divide by 4)
     // - address
@@ -216,6 +550,55 @@ void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data
     eb_send(conn, eth_pkt, 16+size);
 }
 
+
+/*******************************************************************************
+ * Reads data from the device. Data which does not fit in a single record is
+ * split over multiple packets.
+ *
+ * @param conn    The connection to the device.
+ * @param address The address to start reading from.
+ * @param data    The buffer to store the data in.
+ * @param size    The number of bytes to read (multiple of 4).
+ * @param debug   Print the packets when true.
+ * @return 0 on success, -1 on failure.
+ ******************************************************************************/
+int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t size, bool debug) {
+    size_t offset = 0;
+    while (offset < size) {
+        size_t chunk = size - offset;
+        if (chunk > 4*EB_MAX_RECORD_WORDS) chunk = 4*EB_MAX_RECORD_WORDS;
+        eb_wait_for_packet_gap(conn, EB_DEFAULT_PACKET_GAP_NS);
+        if (eb_read8_record(conn, address + offset, data + offset, chunk, debug) < 0) {
+            return -1;
+        }
+        offset += chunk;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Writes data to the device. Data which does not fit in a single record is
+ * split over multiple packets.
+ *
+ * @param conn    The connection to the device.
+ * @param address The address to start writing to.
+ * @param data    The data to write.
+ * @param size    The number of bytes to write (multiple of 4).
+ * @param debug   Print the packets when true.
+ ******************************************************************************/
+void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data, size_t size, bool debug) {
+    size_t offset = 0;
+    while (offset < size) {
+        size_t chunk = size - offset;
+        if (chunk > 4*EB_MAX_RECORD_WORDS) chunk = 4*EB_MAX_RECORD_WORDS;
+        eb_wait_for_packet_gap(conn, EB_DEFAULT_PACKET_GAP_NS);
+        eb_write8_record(conn, address + offset, data + offset, chunk, debug);
+        offset += chunk;
+    }
+    eb_flush(conn);
+}
+
 // https://stackoverflow.com/questions/38071732/how-to-check-if-udp-packet-received-in-c-linux
 void eb_discard_pending_packet(struct eb_connection *conn, size_t size)
 {
@@ -227,7 +610,7 @@ void eb_discard_pending_packet(struct eb_connection *conn, size_t size)
 
     uint8_t buffer[size];
 
-    if (!conn->is_direct) {
+    if (!conn->is_direct || conn->is_raw) {
 	    return;
     }
 
@@ -249,14 +632,33 @@ void eb_discard_pending_packet(struct eb_connection *conn, size_t size)
 }
 
 
-struct eb_connection *eb_connect(const char *addr, const char *port, int is_direct) {
+/**
+ * Determines the local address the host uses to reach the given address.
+ */
+static int eb_local_address(const struct addrinfo *remote, struct sockaddr_in *local) {
+    socklen_t local_len = sizeof(*local);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if ((connect(sock, remote->ai_addr, remote->ai_addrlen) < 0) ||
+        (getsockname(sock, (struct sockaddr *) local, &local_len) < 0)) {
+        close(sock);
+        return -1;
+    }
+    close(sock);
+    return 0;
+}
+
+
+static struct eb_connection *eb_connect_internal(const char *addr, const char *port, const char *rx_port, int is_direct, int bind_local) {
 
     struct addrinfo hints;
     struct addrinfo* res = 0;
     int err;
     int sock;
 
-    struct eb_connection *conn = malloc(sizeof(struct eb_connection));
+    struct eb_connection *conn = calloc(1, sizeof(struct eb_connection));
     if (!conn) {
         perror("couldn't allocate memory for eb_connection");
         return NULL;
@@ -275,6 +677,9 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
     }
 
     conn->is_direct = is_direct;
+    conn->last_tx.tv_sec = 0;
+    conn->last_tx.tv_nsec = 0;
+    conn->recv_timeout_ns = EB_DEFAULT_RECV_TIMEOUT_NS;
 
     if (is_direct) {
         // Rx half
@@ -282,8 +687,25 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
 
         memset((char *) &si_me, 0, sizeof(si_me));
         si_me.sin_family = res->ai_family;
+        // The device responds to the port it listens on, unless it is configured
+        // otherwise (i.e. an emulator running on the same host)
         si_me.sin_port = ((struct sockaddr_in *)res->ai_addr)->sin_port;
+        if (rx_port != NULL) {
+            si_me.sin_port = htons(atoi(rx_port));
+        }
         si_me.sin_addr.s_addr = htobe32(INADDR_ANY);
+        // Only receive the responses which arrive on the interface used to reach the
+        // device, so multiple connections can use the same port
+        if (bind_local) {
+            struct sockaddr_in local;
+            if (eb_local_address(res, &local) < 0) {
+                fprintf(stderr, "Unable to determine the local address for the device: %s\n", strerror(errno));
+                freeaddrinfo(res);
+                free(conn);
+                return NULL;
+            }
+            si_me.sin_addr = local.sin_addr;
+        }
 
         int rx_socket;
         if ((rx_socket = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
@@ -363,10 +785,970 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
     return conn;
 }
 
+
+struct eb_connection *eb_connect(const char *addr, const char *port, const char *rx_port, int is_direct) {
+    return eb_connect_internal(addr, port, rx_port, is_direct, 0);
+}
+
+
+/*******************************************************************************
+ * Connects to a device with UDP, receiving the responses only on the local
+ * address which is used to reach the device. This makes it possible to connect
+ * to the same device over multiple interfaces, each with its own connection.
+ ******************************************************************************/
+struct eb_connection *eb_connect_bound(const char *addr, const char *port, const char *rx_port) {
+    return eb_connect_internal(addr, port, rx_port, 1, 1);
+}
+
+
+/*******************************************************************************
+ * RAW ETHERNET TRANSPORT
+ *
+ * Instead of UDP sockets, the Ethernet, IPv4 and UDP headers are created by the
+ * driver itself and the frames are exchanged with the network card through the
+ * memory mapped rings of an AF_PACKET socket. This bypasses most of the network
+ * stack of the kernel. TPACKET_V2 is used for both rings: with TPACKET_V3 the
+ * received frames only become available when a block is full or its timeout
+ * (at least 1 ms) expires, which is too late for a single response per cycle.
+ ******************************************************************************/
+
+static uint16_t eb_raw_ip_checksum(const uint8_t *header) {
+    uint32_t sum = 0;
+    for (size_t i=0; i<20; i+=2) {
+        sum += (header[i] << 8) | header[i+1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+static int eb_raw_parse_mac(const char *mac, uint8_t *result) {
+    // Both the notation `10:e2:d5:00:00:00` and `0x10e2d5000000` (as used in the
+    // configuration of the firmware) are accepted
+    if ((mac[0] == '0') && ((mac[1] == 'x') || (mac[1] == 'X'))) {
+        char *end;
+        uint64_t value = strtoull(mac, &end, 16);
+        if (*end != '\0') return -1;
+        for (size_t i=0; i<6; i++) {
+            result[i] = (value >> (8 * (5 - i))) & 0xFF;
+        }
+        return 0;
+    }
+    if (sscanf(mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", 
+            &result[0], &result[1], &result[2], &result[3], &result[4], &result[5]) != 6) {
+        return -1;
+    }
+    return 0;
+}
+
+static int eb_raw_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt) {
+    struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (conn->ring + conn->rx_ring_size + conn->tx_frame * EB_RAW_FRAME_SIZE);
+    uint8_t *frame = (uint8_t *) hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+    size_t len = 0;
+
+    // The frame is still in use by the kernel when the ring is full
+    if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // Copy the payload directly into the ring
+    for (int i=0; i<iovcnt; i++) {
+        if (EB_RAW_HEADER_SIZE + len + iov[i].iov_len > EB_RAW_FRAME_SIZE - TPACKET2_HDRLEN) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        memcpy(frame + EB_RAW_HEADER_SIZE + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    // Complete the headers with the length of the payload
+    memcpy(frame, conn->frame_header, EB_RAW_HEADER_SIZE);
+    uint16_t ip_len = htobe16(20 + 8 + len);
+    uint16_t ip_id = htobe16(conn->ip_id++);
+    uint16_t udp_len = htobe16(8 + len);
+    memcpy(frame + 16, &ip_len, 2);
+    memcpy(frame + 18, &ip_id, 2);
+    uint16_t checksum = htobe16(eb_raw_ip_checksum(frame + 14));
+    memcpy(frame + 24, &checksum, 2);
+    memcpy(frame + 38, &udp_len, 2);
+
+    // Hand the frame over to the kernel and request it to be sent
+    hdr->tp_len = EB_RAW_HEADER_SIZE + len;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+    conn->tx_frame = (conn->tx_frame + 1) % EB_RAW_TX_FRAMES;
+    if (send(conn->fd, NULL, 0, MSG_DONTWAIT) < 0) {
+        return -1;
+    }
+    return len;
+}
+
+static int eb_raw_recv(struct eb_connection *conn, void *bytes, size_t max_len, long timeout_ns) {
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    eb_timespec_add_ns(&deadline, timeout_ns);
+
+    while (true) {
+        struct tpacket2_hdr *hdr = (struct tpacket2_hdr *) (conn->ring + conn->rx_frame * EB_RAW_FRAME_SIZE);
+
+        // Wait for the kernel to put a frame in the ring
+        if (!(hdr->tp_status & TP_STATUS_USER)) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long remaining_ns = eb_timespec_diff_ns(&deadline, &now);
+            if (remaining_ns <= 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+            struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+            poll(&pfd, 1, (remaining_ns + 999999) / 1000000);
+            continue;
+        }
+        __sync_synchronize();
+
+        // Only accept UDP-packets from the board
+        int len = -1;
+        uint8_t *frame = (uint8_t *) hdr + hdr->tp_mac;
+        if ((hdr->tp_snaplen >= EB_RAW_HEADER_SIZE) &&
+            (frame[12] == 0x08) && (frame[13] == 0x00) &&
+            (frame[23] == 17) &&
+            (memcmp(frame + 26, &conn->remote_ip, 4) == 0)) {
+            size_t ip_header_len = (frame[14] & 0x0F) * 4;
+            uint8_t *udp = frame + 14 + ip_header_len;
+            uint16_t udp_len;
+            memcpy(&udp_len, udp + 4, 2);
+            udp_len = be16toh(udp_len);
+            if ((memcmp(udp, &conn->remote_port, 2) == 0) &&
+                (udp_len >= 8) &&
+                (14 + ip_header_len + udp_len <= hdr->tp_snaplen)) {
+                len = udp_len - 8;
+                if (len > max_len) len = max_len;
+                memcpy(bytes, udp + 8, len);
+            }
+        }
+
+        // Return the frame to the kernel
+        __sync_synchronize();
+        hdr->tp_status = TP_STATUS_KERNEL;
+        conn->rx_frame = (conn->rx_frame + 1) % EB_RAW_RX_FRAMES;
+        if (len >= 0) {
+            return len;
+        }
+    }
+}
+
+
+/*******************************************************************************
+ * Creates a connection to the board using raw Ethernet frames.
+ *
+ * @param ifname The name of the network interface the board is connected to.
+ * @param mac    The MAC-address of the board.
+ * @param addr   The IP-address of the board.
+ * @param port   The UDP-port of the board.
+ * @return The connection, or NULL when the connection could not be made.
+ ******************************************************************************/
+struct eb_connection *eb_connect_raw(const char *ifname, const char *mac, const char *addr, const char *port) {
+    struct ifreq ifr;
+    struct in_addr remote_ip;
+    uint8_t remote_mac[6];
+    uint8_t local_mac[6];
+    uint32_t local_ip;
+
+    if (eb_raw_parse_mac(mac, remote_mac) < 0) {
+        fprintf(stderr, "etherbone: invalid MAC-address '%s'\n", mac);
+        return NULL;
+    }
+    if (inet_pton(AF_INET, addr, &remote_ip) != 1) {
+        fprintf(stderr, "etherbone: invalid IP-address '%s'\n", addr);
+        return NULL;
+    }
+
+    struct eb_connection *conn = calloc(1, sizeof(struct eb_connection));
+    if (!conn) {
+        perror("couldn't allocate memory for eb_connection");
+        return NULL;
+    }
+    conn->is_raw = 1;
+    conn->recv_timeout_ns = EB_DEFAULT_RECV_TIMEOUT_NS;
+    conn->remote_ip = remote_ip.s_addr;
+    conn->remote_port = htobe16(atoi(port));
+
+    conn->fd = socket(AF_PACKET, SOCK_RAW, htobe16(ETH_P_IP));
+    if (conn->fd < 0) {
+        fprintf(stderr, "etherbone: unable to create raw socket: %s\n", strerror(errno));
+        free(conn);
+        return NULL;
+    }
+
+    // Retrieve the index, MAC-address and IP-address of the interface
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(conn->fd, SIOCGIFINDEX, &ifr) < 0) {
+        fprintf(stderr, "etherbone: unknown interface '%s': %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+    int ifindex = ifr.ifr_ifindex;
+    if (ioctl(conn->fd, SIOCGIFHWADDR, &ifr) < 0) {
+        fprintf(stderr, "etherbone: unable to get MAC-address of '%s': %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+    memcpy(local_mac, ifr.ifr_hwaddr.sa_data, 6);
+    ifr.ifr_addr.sa_family = AF_INET;
+    if (ioctl(conn->fd, SIOCGIFADDR, &ifr) < 0) {
+        fprintf(stderr, "etherbone: unable to get IP-address of '%s': %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+    local_ip = ((struct sockaddr_in *) &ifr.ifr_addr)->sin_addr.s_addr;
+
+    // Create the rings and map them in memory
+    int version = TPACKET_V2;
+    if (setsockopt(conn->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        fprintf(stderr, "etherbone: unable to set TPACKET_V2: %s\n", strerror(errno));
+        goto fail;
+    }
+    struct tpacket_req req;
+    req.tp_block_size = EB_RAW_BLOCK_SIZE;
+    req.tp_frame_size = EB_RAW_FRAME_SIZE;
+    req.tp_frame_nr = EB_RAW_RX_FRAMES;
+    req.tp_block_nr = EB_RAW_RX_FRAMES * EB_RAW_FRAME_SIZE / EB_RAW_BLOCK_SIZE;
+    if (setsockopt(conn->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        fprintf(stderr, "etherbone: unable to create Rx ring: %s\n", strerror(errno));
+        goto fail;
+    }
+    conn->rx_ring_size = req.tp_block_nr * req.tp_block_size;
+    req.tp_frame_nr = EB_RAW_TX_FRAMES;
+    req.tp_block_nr = EB_RAW_TX_FRAMES * EB_RAW_FRAME_SIZE / EB_RAW_BLOCK_SIZE;
+    if (setsockopt(conn->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        fprintf(stderr, "etherbone: unable to create Tx ring: %s\n", strerror(errno));
+        goto fail;
+    }
+    conn->ring_size = conn->rx_ring_size + req.tp_block_nr * req.tp_block_size;
+    // - frames are sent directly to the network card, skipping the queueing discipline
+    int one = 1;
+    setsockopt(conn->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    conn->ring = mmap(NULL, conn->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, conn->fd, 0);
+    if (conn->ring == MAP_FAILED) {
+        fprintf(stderr, "etherbone: unable to map rings: %s\n", strerror(errno));
+        conn->ring = NULL;
+        goto fail;
+    }
+
+    // Bind the socket to the interface
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htobe16(ETH_P_IP);
+    sll.sll_ifindex = ifindex;
+    if (bind(conn->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+        fprintf(stderr, "etherbone: unable to bind to '%s': %s\n", ifname, strerror(errno));
+        goto fail;
+    }
+
+    // Create the template for the headers. The length fields, the identification and the
+    // checksum of the IP-header are filled in when the packet is sent. The UDP checksum is
+    // optional for IPv4 and left zero.
+    uint8_t *header = conn->frame_header;
+    memcpy(header + 0, remote_mac, 6);
+    memcpy(header + 6, local_mac, 6);
+    header[12] = 0x08;                          // Ethertype IPv4
+    header[13] = 0x00;
+    header[14] = 0x45;                          // Version 4, header length 5 words
+    header[20] = 0x40;                          // Don't fragment
+    header[22] = 64;                            // Time to live
+    header[23] = 17;                            // Protocol UDP
+    memcpy(header + 26, &local_ip, 4);
+    memcpy(header + 30, &conn->remote_ip, 4);
+    memcpy(header + 34, &conn->remote_port, 2); // Responses are sent to the same port
+    memcpy(header + 36, &conn->remote_port, 2);
+
+    return conn;
+
+fail:
+    if (conn->ring) munmap(conn->ring, conn->ring_size);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+/*******************************************************************************
+ * PACKET TIMESTAMPING
+ *
+ * With SO_TIMESTAMPING the kernel records the moment a packet is handed to the
+ * network card and the moment a packet has been received. The timestamps of the
+ * packets sent are returned on the error queue of the socket, identified by the
+ * number of the packet (counting from the moment timestamping was enabled). When
+ * the network card supports it, the card itself timestamps the packets as well.
+ * Software timestamps are in CLOCK_REALTIME, hardware timestamps in the clock of
+ * the network card.
+ ******************************************************************************/
+
+static void eb_parse_timestamps(struct msghdr *msg, struct timespec *software, struct timespec *hardware, uint32_t *id) {
+    struct cmsghdr *cmsg;
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+            // Index 0 holds the software timestamp, index 2 the raw hardware timestamp
+            struct timespec stamps[3];
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            *software = stamps[0];
+            *hardware = stamps[2];
+        } else if ((id != NULL) && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) {
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if ((error.ee_errno == ENOMSG) && (error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)) {
+                *id = error.ee_data;
+            }
+        }
+    }
+}
+
+static int eb_recv_timestamped(struct eb_connection *conn, void *bytes, size_t max_len, int flags) {
+    char control[256];
+    struct iovec iov = {.iov_base = bytes, .iov_len = max_len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int r = recvmsg(conn->read_fd, &msg, flags);
+    if (r >= 0) {
+        memset(&conn->rx_software, 0, sizeof(conn->rx_software));
+        memset(&conn->rx_hardware, 0, sizeof(conn->rx_hardware));
+        eb_parse_timestamps(&msg, &conn->rx_software, &conn->rx_hardware, NULL);
+    }
+    return r;
+}
+
+/**
+ * Enables hardware timestamping on the network interface which is used to reach
+ * the board. Requires CAP_NET_ADMIN and a network card which supports it. The
+ * original configuration of the interface is restored by `eb_disconnect`.
+ */
+static int eb_enable_hardware_timestamping(struct eb_connection *conn) {
+    struct sockaddr_in local;
+    struct ifaddrs *ifaddrs, *ifa;
+    struct ifreq ifr;
+    struct hwtstamp_config config;
+    int r = -1;
+
+    // Determine the local address used to reach the board, and the interface with
+    // this address
+    if ((eb_local_address(conn->addr, &local) < 0) || (getifaddrs(&ifaddrs) < 0)) {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        freeifaddrs(ifaddrs);
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+        if ((ifa->ifa_addr != NULL) && (ifa->ifa_addr->sa_family == AF_INET) &&
+            (((struct sockaddr_in *) ifa->ifa_addr)->sin_addr.s_addr == local.sin_addr.s_addr)) {
+            strncpy(ifr.ifr_name, ifa->ifa_name, IFNAMSIZ - 1);
+            break;
+        }
+    }
+    freeifaddrs(ifaddrs);
+
+    if (!ifr.ifr_name[0]) {
+        close(sock);
+        return -1;
+    }
+
+    // Retrieve the current configuration, so it can be restored. Drivers which do
+    // not support SIOCGHWTSTAMP are assumed to have timestamping disabled.
+    memset(&conn->hwtstamp_saved, 0, sizeof(conn->hwtstamp_saved));
+    conn->hwtstamp_saved.tx_type = HWTSTAMP_TX_OFF;
+    conn->hwtstamp_saved.rx_filter = HWTSTAMP_FILTER_NONE;
+    ifr.ifr_data = (void *) &conn->hwtstamp_saved;
+    ioctl(sock, SIOCGHWTSTAMP, &ifr);
+
+    // Timestamp the packets sent. The responses of the board are plain UDP packets,
+    // which are only matched by HWTSTAMP_FILTER_ALL; when the network card does not
+    // support this filter, only the transmitted packets are timestamped and the
+    // receive filter is left untouched.
+    if ((conn->hwtstamp_saved.tx_type == HWTSTAMP_TX_ON) &&
+        (conn->hwtstamp_saved.rx_filter == HWTSTAMP_FILTER_ALL)) {
+        r = 0;
+    } else {
+        memset(&config, 0, sizeof(config));
+        config.tx_type = HWTSTAMP_TX_ON;
+        config.rx_filter = HWTSTAMP_FILTER_ALL;
+        ifr.ifr_data = (void *) &config;
+        r = ioctl(sock, SIOCSHWTSTAMP, &ifr);
+        if (r < 0) {
+            config.tx_type = HWTSTAMP_TX_ON;
+            config.rx_filter = conn->hwtstamp_saved.rx_filter;
+            ifr.ifr_data = (void *) &config;
+            r = ioctl(sock, SIOCSHWTSTAMP, &ifr);
+        }
+        if (r == 0) {
+            memcpy(conn->hwtstamp_ifname, ifr.ifr_name, IFNAMSIZ);
+        }
+    }
+    close(sock);
+    return r;
+}
+
+
+/**
+ * Restores the hardware timestamping configuration of the network interface, when
+ * it has been changed by `eb_enable_hardware_timestamping`.
+ */
+static void eb_restore_hardware_timestamping(struct eb_connection *conn) {
+    struct ifreq ifr;
+
+    if (!conn->hwtstamp_ifname[0]) {
+        return;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock >= 0) {
+        memset(&ifr, 0, sizeof(ifr));
+        memcpy(ifr.ifr_name, conn->hwtstamp_ifname, IFNAMSIZ);
+        ifr.ifr_data = (void *) &conn->hwtstamp_saved;
+        ioctl(sock, SIOCSHWTSTAMP, &ifr);
+        close(sock);
+    }
+    conn->hwtstamp_ifname[0] = 0;
+}
+
+
+/*******************************************************************************
+ * Enables timestamping of the packets sent and received on the connection.
+ *
+ * @param conn     The connection, which must use UDP sockets.
+ * @param hardware When set, the network card is requested to timestamp the
+ * packets as well.
+ * @return -1 when timestamping could not be enabled, 0 when only software
+ * timestamps are available, 1 when hardware timestamps are available as well.
+ ******************************************************************************/
+int eb_enable_timestamping(struct eb_connection *conn, int hardware) {
+    int result = 0;
+    int flags;
+
+    if (conn->is_raw || conn->uring || !conn->is_direct) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (hardware && (eb_enable_hardware_timestamping(conn) == 0)) {
+        result = 1;
+    }
+
+    // Packets sent, the timestamps are put on the error queue without the data
+    flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (result) {
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE;
+    }
+    if (setsockopt(conn->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        return -1;
+    }
+    // Packets received
+    flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+    if (result) {
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    }
+    if (setsockopt(conn->read_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        return -1;
+    }
+
+    conn->timestamping = 1;
+    conn->tx_count = 0;
+    return result;
+}
+
+
+/*******************************************************************************
+ * Returns the number of the last packet sent, with which its timestamp can be
+ * identified (see `eb_get_tx_timestamp`).
+ ******************************************************************************/
+uint32_t eb_last_tx_id(struct eb_connection *conn) {
+    return conn->tx_count - 1;
+}
+
+
+/*******************************************************************************
+ * Retrieves the timestamp of a packet sent from the error queue, without waiting.
+ *
+ * @param conn     The connection.
+ * @param id       The number of the packet (see `eb_last_tx_id`).
+ * @param software The software timestamp (zero when not available).
+ * @param hardware The hardware timestamp (zero when not available).
+ * @return 1 when a timestamp has been retrieved, 0 when the queue is empty.
+ ******************************************************************************/
+int eb_get_tx_timestamp(struct eb_connection *conn, uint32_t *id, struct timespec *software, struct timespec *hardware) {
+    char control[256];
+    struct msghdr msg;
+
+    if (!conn->timestamping) {
+        return 0;
+    }
+    while (true) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return 0;
+        }
+        memset(software, 0, sizeof(*software));
+        memset(hardware, 0, sizeof(*hardware));
+        *id = 0xFFFFFFFF;
+        eb_parse_timestamps(&msg, software, hardware, id);
+        if (*id != 0xFFFFFFFF) {
+            return 1;
+        }
+    }
+}
+
+
+/*******************************************************************************
+ * Returns the timestamps of the last packet received.
+ *
+ * @param conn     The connection.
+ * @param software The software timestamp (zero when not available).
+ * @param hardware The hardware timestamp (zero when not available).
+ ******************************************************************************/
+void eb_get_rx_timestamp(struct eb_connection *conn, struct timespec *software, struct timespec *hardware) {
+    *software = conn->rx_software;
+    *hardware = conn->rx_hardware;
+}
+
+
+/*******************************************************************************
+ * IO_URING TRANSPORT
+ *
+ * The UDP sockets can be driven by an io_uring instead of a system call for each
+ * packet. Packets sent are queued in the submission queue and are submitted
+ * together with the next receive, linked to it: the request and the receive of
+ * the response (with a timeout) are then handled by a single system call. Sends
+ * which are not followed by a receive are submitted by `eb_flush` or before
+ * waiting for the gap between two packets. With SQPOLL a kernel thread picks up
+ * the submissions and the completions are polled, so no system calls are needed
+ * at all. The ring is set up with raw system calls, no library is required.
+ ******************************************************************************/
+#ifdef EB_HAVE_IO_URING
+
+static int eb_uring_enter(struct eb_uring *uring, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int eb_uring_buffer_index(struct eb_uring *uring, const void *data, size_t len) {
+    for (int i=0; i<uring->num_buffers; i++) {
+        const uint8_t *start = uring->buffers[i].iov_base;
+        if (((const uint8_t *) data >= start) && ((const uint8_t *) data + len <= start + uring->buffers[i].iov_len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Makes the queued entries visible to the kernel. When `wait` is set, the call
+ * blocks until at least one completion is available.
+ */
+static int eb_uring_submit(struct eb_connection *conn, int wait) {
+    struct eb_uring *uring = conn->uring;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int r = 0;
+
+    if (uring->unsubmitted) {
+        __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+        clock_gettime(CLOCK_MONOTONIC, &conn->last_tx);
+    }
+    if (uring->sqpoll) {
+        // The kernel thread picks up the entries, it only has to be woken when it has
+        // gone to sleep after being idle
+        if (__atomic_load_n(uring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        if (flags) {
+            r = eb_uring_enter(uring, 0, wait ? 1 : 0, flags);
+        }
+    } else if (uring->unsubmitted || wait) {
+        r = eb_uring_enter(uring, uring->unsubmitted, wait ? 1 : 0, flags);
+    }
+    uring->unsubmitted = 0;
+    uring->last_send = NULL;
+    return r;
+}
+
+/**
+ * Makes sure the given number of entries are available in the submission queue,
+ * submitting the queued entries when the queue is full.
+ */
+static int eb_uring_reserve(struct eb_connection *conn, unsigned count) {
+    struct eb_uring *uring = conn->uring;
+
+    if (uring->sq_local_tail + count - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > uring->sq_entries) {
+        eb_uring_submit(conn, 0);
+        if (uring->sq_local_tail + count - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > uring->sq_entries) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *eb_uring_get_sqe(struct eb_connection *conn) {
+    struct eb_uring *uring = conn->uring;
+
+    if (eb_uring_reserve(conn, 1) < 0) {
+        return NULL;
+    }
+    unsigned index = uring->sq_local_tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    uring->sq_local_tail++;
+    uring->unsubmitted++;
+    return sqe;
+}
+
+/**
+ * Processes the available completions. Returns 1 and stores the result of the
+ * receive in `res` when the completion of the current receive has been found.
+ * Completions of earlier receives are ignored.
+ */
+static int eb_uring_reap(struct eb_uring *uring, int *res) {
+    int found = 0;
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+        if (cqe->user_data == uring->recv_tag) {
+            *res = cqe->res;
+            found = 1;
+        } else if ((cqe->user_data == EB_URING_TAG_SEND) && (cqe->res < 0)) {
+            uring->send_errors++;
+        }
+        // Completions of the timeouts are not relevant
+        head++;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    return found;
+}
+
+static int eb_uring_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt) {
+    struct eb_uring *uring = conn->uring;
+    int len = 0;
+
+    if (iovcnt > EB_URING_MAX_IOV) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = eb_uring_get_sqe(conn);
+    if (sqe == NULL) {
+        return -1;
+    }
+    for (int i=0; i<iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    sqe->fd = conn->fd;
+    sqe->user_data = EB_URING_TAG_SEND;
+    int buffer_index = (iovcnt == 1) ? eb_uring_buffer_index(uring, iov[0].iov_base, iov[0].iov_len) : -1;
+    if (buffer_index >= 0) {
+        // Data in a registered buffer does not have to be mapped by the kernel
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uint64_t) (uintptr_t) iov[0].iov_base;
+        sqe->len = iov[0].iov_len;
+        sqe->buf_index = buffer_index;
+    } else {
+        // The io-vectors of the caller might be gone when the entry is submitted
+        struct iovec *copy = uring->iov[(uring->sq_local_tail - 1) & *uring->sq_mask];
+        memcpy(copy, iov, iovcnt * sizeof(struct iovec));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = (uint64_t) (uintptr_t) copy;
+        sqe->len = iovcnt;
+    }
+    uring->last_send = sqe;
+    return len;
+}
+
+/**
+ * Cancels the current receive when waiting for it has failed, and waits until it
+ * has completed, so the kernel does not write into the buffer of the caller after
+ * the receive has been reported as failed. The linked timeout completes the receive
+ * anyway, waiting is limited to twice that timeout.
+ */
+static void eb_uring_cancel_recv(struct eb_connection *conn) {
+    struct eb_uring *uring = conn->uring;
+    struct timespec now, delay = {.tv_sec = 0, .tv_nsec = 10000};
+    int res;
+
+    struct io_uring_sqe *sqe = eb_uring_get_sqe(conn);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = uring->recv_tag;
+        sqe->user_data = EB_URING_TAG_CANCEL;
+        eb_uring_submit(conn, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timespec deadline = now;
+    eb_timespec_add_ns(&deadline, 2 * conn->recv_timeout_ns);
+    while (!eb_uring_reap(uring, &res) && (eb_timespec_diff_ns(&deadline, &now) > 0)) {
+        nanosleep(&delay, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+}
+
+static int eb_uring_recv(struct eb_connection *conn, void *bytes, size_t max_len, int spin) {
+    struct eb_uring *uring = conn->uring;
+    int res = 0;
+
+    // Both entries of the receive are reserved before the last packet sent is linked
+    // to them, so a failure does not leave the link on the packet sent
+    if (eb_uring_reserve(conn, 2) < 0) {
+        return -1;
+    }
+
+    // Link the receive to the last packet sent, so the request and the response are
+    // handled with a single submission
+    if (uring->last_send != NULL) {
+        uring->last_send->flags |= IOSQE_IO_LINK;
+    }
+    struct io_uring_sqe *sqe = eb_uring_get_sqe(conn);
+    int buffer_index = eb_uring_buffer_index(uring, bytes, max_len);
+    sqe->opcode = (buffer_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = conn->is_direct ? conn->read_fd : conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) bytes;
+    sqe->len = max_len;
+    sqe->buf_index = (buffer_index >= 0) ? buffer_index : 0;
+    sqe->flags = IOSQE_IO_LINK;
+    uring->recv_tag = EB_URING_TAG_RECV | (((uring->recv_tag >> 8) + 1) << 8);
+    sqe->user_data = uring->recv_tag;
+
+    // The receive is cancelled when no response has arrived before the timeout
+    uring->timeout.tv_sec = conn->recv_timeout_ns / 1000000000L;
+    uring->timeout.tv_nsec = conn->recv_timeout_ns % 1000000000L;
+    sqe = eb_uring_get_sqe(conn);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->timeout;
+    sqe->len = 1;
+    sqe->user_data = EB_URING_TAG_TIMEOUT;
+
+    // Wait for the completion of the receive. With SQPOLL the completions can be
+    // polled without entering the kernel.
+    spin = spin && uring->sqpoll;
+    eb_uring_submit(conn, !spin);
+    while (!eb_uring_reap(uring, &res)) {
+        if (!spin && (eb_uring_enter(uring, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) {
+            int error = errno;
+            eb_uring_cancel_recv(conn);
+            errno = error;
+            return -1;
+        }
+    }
+    if (res < 0) {
+        // Report a timeout in the same way as a socket with a receive timeout
+        errno = ((res == -ECANCELED) || (res == -ETIME)) ? EAGAIN : -res;
+        return -1;
+    }
+    return res;
+}
+
+#endif
+
+
+/*******************************************************************************
+ * Drives the UDP sockets of the connection with an io_uring (see above).
+ *
+ * @param conn   The connection, which must use UDP (not the raw transport).
+ * @param sqpoll When set, a kernel thread polls the submission queue.
+ * @return 0 on success, -1 when the io_uring could not be created. The connection
+ * then keeps using the sockets directly.
+ ******************************************************************************/
+int eb_setup_io_uring(struct eb_connection *conn, int sqpoll) {
+#ifdef EB_HAVE_IO_URING
+    struct io_uring_params params;
+    struct eb_uring *uring;
+
+    if (conn->is_raw || !conn->is_direct) {
+        errno = EINVAL;
+        return -1;
+    }
+    uring = calloc(1, sizeof(struct eb_uring));
+    if (!uring) {
+        return -1;
+    }
+
+    memset(&params, 0, sizeof(params));
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        // Keep the kernel thread awake between the cycles
+        params.sq_thread_idle = EB_URING_SQ_THREAD_IDLE_MS;
+    }
+    uring->fd = syscall(__NR_io_uring_setup, EB_URING_ENTRIES, &params);
+    if (uring->fd < 0) {
+        free(uring);
+        return -1;
+    }
+    uring->sqpoll = sqpoll;
+    uring->sq_entries = params.sq_entries;
+
+    // Map the rings, with a single mapping when supported by the kernel
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) uring->sq_ring_size = uring->cq_ring_size;
+        uring->cq_ring_size = 0;
+    }
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    uring->cq_ring = uring->sq_ring;
+    if ((uring->sq_ring != MAP_FAILED) && uring->cq_ring_size) {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+    }
+    uring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if ((uring->sq_ring == MAP_FAILED) || (uring->cq_ring == MAP_FAILED) || (uring->sqes == MAP_FAILED)) {
+        int error = errno;
+        if (uring->sqes != MAP_FAILED) munmap(uring->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        if (uring->cq_ring_size && (uring->cq_ring != MAP_FAILED)) munmap(uring->cq_ring, uring->cq_ring_size);
+        if (uring->sq_ring != MAP_FAILED) munmap(uring->sq_ring, uring->sq_ring_size);
+        close(uring->fd);
+        free(uring);
+        errno = error;
+        return -1;
+    }
+    uring->sq_head  = (unsigned *) ((uint8_t *) uring->sq_ring + params.sq_off.head);
+    uring->sq_tail  = (unsigned *) ((uint8_t *) uring->sq_ring + params.sq_off.tail);
+    uring->sq_mask  = (unsigned *) ((uint8_t *) uring->sq_ring + params.sq_off.ring_mask);
+    uring->sq_flags = (unsigned *) ((uint8_t *) uring->sq_ring + params.sq_off.flags);
+    uring->sq_array = (unsigned *) ((uint8_t *) uring->sq_ring + params.sq_off.array);
+    uring->cq_head  = (unsigned *) ((uint8_t *) uring->cq_ring + params.cq_off.head);
+    uring->cq_tail  = (unsigned *) ((uint8_t *) uring->cq_ring + params.cq_off.tail);
+    uring->cq_mask  = (unsigned *) ((uint8_t *) uring->cq_ring + params.cq_off.ring_mask);
+    uring->cqes     = (struct io_uring_cqe *) ((uint8_t *) uring->cq_ring + params.cq_off.cqes);
+    uring->sq_local_tail = *uring->sq_tail;
+
+    // The packets are written to the socket, which requires the socket to be connected
+    // to the board. Sending to the board with `sendto` remains possible.
+    if (connect(conn->fd, conn->addr->ai_addr, conn->addr->ai_addrlen) < 0) {
+        int error = errno;
+        conn->uring = uring;
+        eb_close_io_uring(conn);
+        errno = error;
+        return -1;
+    }
+
+    conn->uring = uring;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/*******************************************************************************
+ * Registers buffers with the io_uring of the connection. Packets sent from and
+ * received in these buffers are not mapped by the kernel for each packet.
+ *
+ * @param conn    The connection.
+ * @param buffers The buffers to register.
+ * @param count   The number of buffers (at most EB_URING_MAX_BUFFERS).
+ * @return 0 on success, -1 when the buffers could not be registered.
+ ******************************************************************************/
+int eb_register_buffers(struct eb_connection *conn, const struct iovec *buffers, int count) {
+#ifdef EB_HAVE_IO_URING
+    if ((conn->uring == NULL) || (count > EB_URING_MAX_BUFFERS)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (syscall(__NR_io_uring_register, conn->uring->fd, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+        return -1;
+    }
+    memcpy(conn->uring->buffers, buffers, count * sizeof(struct iovec));
+    conn->uring->num_buffers = count;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/*******************************************************************************
+ * Submits the packets which are queued in the io_uring of the connection,
+ * without waiting for their completion. Does nothing for other connections.
+ *
+ * @param conn The connection.
+ ******************************************************************************/
+void eb_flush(struct eb_connection *conn) {
+#ifdef EB_HAVE_IO_URING
+    int res;
+    if (conn->uring) {
+        eb_uring_submit(conn, 0);
+        // Process the completions of earlier packets, so the queue does not overflow
+        eb_uring_reap(conn->uring, &res);
+    }
+#endif
+}
+
+
+/*******************************************************************************
+ * Sets the time to wait for a response when the connection uses an io_uring or
+ * the raw transport. The UDP sockets use the timeout of the socket, or the
+ * timeout passed to `eb_recv_any`.
+ *
+ * @param conn       The connection.
+ * @param timeout_ns The timeout in nanoseconds.
+ ******************************************************************************/
+void eb_set_recv_timeout(struct eb_connection *conn, long timeout_ns) {
+    conn->recv_timeout_ns = timeout_ns;
+}
+
+
+/*******************************************************************************
+ * Returns the number of packets of which the send has failed since the previous
+ * call. Only the io_uring reports these separately, as the packets are sent after
+ * `eb_send` has returned.
+ *
+ * @param conn       The connection.
+ ******************************************************************************/
+unsigned eb_take_send_errors(struct eb_connection *conn) {
+    unsigned errors = 0;
+#ifdef EB_HAVE_IO_URING
+    if (conn->uring != NULL) {
+        errors = conn->uring->send_errors;
+        conn->uring->send_errors = 0;
+    }
+#endif
+    return errors;
+}
+
+
+static void eb_close_io_uring(struct eb_connection *conn) {
+#ifdef EB_HAVE_IO_URING
+    struct eb_uring *uring = conn->uring;
+    if (uring == NULL) {
+        return;
+    }
+    munmap(uring->sqes, uring->sq_entries * sizeof(struct io_uring_sqe));
+    if (uring->cq_ring_size) munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sq_ring, uring->sq_ring_size);
+    close(uring->fd);
+    free(uring);
+    conn->uring = NULL;
+#endif
+}
+
+
 void eb_disconnect(struct eb_connection **conn) {
     if (!conn || !*conn)
         return;
 
+    eb_close_io_uring(*conn);
+
+    if ((*conn)->is_raw) {
+        munmap((*conn)->ring, (*conn)->ring_size);
+        close((*conn)->fd);
+        free(*conn);
+        *conn = NULL;
+        return;
+    }
+    eb_restore_hardware_timestamping(*conn);
     freeaddrinfo((*conn)->addr);
     close((*conn)->fd);
     if ((*conn)->read_fd)
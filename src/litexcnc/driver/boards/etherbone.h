@@ -6,6 +6,8 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include <stdint.h>
+#include <sys/uio.h>
+#include <time.h>
 
 /*
 
@@ -56,24 +58,59 @@ is set to 1.  For a read, the read_addr is specified.  For a write, the
 write_addr is specified along with a value.
 
 The same type of record is returned, so your data is at offset 16.
+
+A single record may also contain both writes and reads. In that case the
+record header holds both wcount and rcount, the write_addr and the values
+are followed by the base return address and the read addresses. The writes
+are executed before the reads, so the returned data reflects the state of
+the device directly after the writes.
+
+When the firmware is built with support for burst reads, the flag rca in
+the record indicates a burst read. The base return address is then followed
+by a single address; the device reads rcount consecutive words starting at
+this address. The response is the same as for a normal read.
 */
 #define SEND_TIMEOUT_US 10
+// Maximum number of words in a single record (the counts in the record are a single byte)
+#define EB_MAX_RECORD_WORDS 255
+// Default minimum time between two packets, required by the LiteX Ethernet core
+#define EB_DEFAULT_PACKET_GAP_NS 10000
+// Default time the kernel polls the network card when busy polling is enabled
+#define EB_DEFAULT_BUSY_POLL_US 50
+// Flag (rca) in the first byte of the record indicating a burst read
+#define EB_RECORD_FLAG_BURST_READ 0x02
+// Default time to wait for a response (same as the receive timeout of the sockets)
+#define EB_DEFAULT_RECV_TIMEOUT_NS 10000000L
 
 struct eb_connection;
 static const uint8_t etherbone_header[16] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
 
 int eb_send(struct eb_connection *conn, const void *bytes, size_t len);
 int eb_recv(struct eb_connection *conn, void *bytes, size_t max_len);
+int eb_sendv(struct eb_connection *conn, const struct iovec *iov, int iovcnt);
+int eb_set_busy_poll(struct eb_connection *conn, int usec);
+int eb_recv_spin(struct eb_connection *conn, void *bytes, size_t max_len, long max_spin_ns, long *spin_ns);
+int eb_recv_any(struct eb_connection **conns, int count, void *bytes, size_t max_len, long max_spin_ns, long timeout_ns, int *index, long *spin_ns);
 
 int eb_create_packet(uint8_t* eth_buffer, uint32_t address, const uint8_t* data, size_t size, int is_read);
 void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data, size_t size, bool debug);
 int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t size, bool debug);
-void usecSleep(long usec);
 
-void eb_wait_for_tx_buffer_empty(struct eb_connection *conn);
+long eb_wait_for_packet_gap(struct eb_connection *conn, long gap_ns);
 void eb_discard_pending_packet(struct eb_connection *conn, size_t size);
 
-struct eb_connection *eb_connect(const char *addr, const char *port, int is_direct);
+struct eb_connection *eb_connect(const char *addr, const char *port, const char *rx_port, int is_direct);
+struct eb_connection *eb_connect_bound(const char *addr, const char *port, const char *rx_port);
+struct eb_connection *eb_connect_raw(const char *ifname, const char *mac, const char *addr, const char *port);
+int eb_setup_io_uring(struct eb_connection *conn, int sqpoll);
+int eb_register_buffers(struct eb_connection *conn, const struct iovec *buffers, int count);
+void eb_set_recv_timeout(struct eb_connection *conn, long timeout_ns);
+unsigned eb_take_send_errors(struct eb_connection *conn);
+void eb_flush(struct eb_connection *conn);
+int eb_enable_timestamping(struct eb_connection *conn, int hardware);
+uint32_t eb_last_tx_id(struct eb_connection *conn);
+int eb_get_tx_timestamp(struct eb_connection *conn, uint32_t *id, struct timespec *software, struct timespec *hardware);
+void eb_get_rx_timestamp(struct eb_connection *conn, struct timespec *software, struct timespec *hardware);
 void eb_disconnect(struct eb_connection **conn);
 
 #ifdef __cplusplus
@@ -15,7 +15,9 @@
 //    along with this program; if not, write to the Free Software
 //    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 //
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <rtapi_slab.h>
 #include <rtapi_list.h>
@@ -82,6 +84,8 @@ static void dict_free(struct rtapi_list_head *head) {
  */
 static litexcnc_driver_registration_t *registration;
 
+#ifndef LITEXCNC_ETH_RAW
+// The raw variant registers itself in litexcnc_ethraw.c
 int register_eth_driver(void) {
     registration = (litexcnc_driver_registration_t *)hal_malloc(sizeof(litexcnc_driver_registration_t));
     rtapi_snprintf(registration->name, sizeof(registration->name), "eth");
@@ -90,6 +94,7 @@ int register_eth_driver(void) {
     return litexcnc_register_driver(registration);
 }
 EXPORT_SYMBOL_GPL(register_eth_driver);
+#endif
 
 
 static int litexcnc_eth_read_n_bits(litexcnc_fpga_t *this, size_t address, uint8_t *data, size_t size) {
@@ -123,64 +128,693 @@ static int litexcnc_eth_write_n_bits(litexcnc_fpga_t *this, size_t address, uint
     return 0;
 }
 
-static int litexcnc_eth_read(litexcnc_fpga_t *this) {
+static void litexcnc_eth_wait_for_packet_gap(litexcnc_eth_t *board, struct eb_connection *connection) {
+    // This is essential as the colorlight card crashes when two packets come close to each other.
+    // This prevents crashes in the litex eth core. 
+    // Also turn of mDNS request from linux to the colorlight card. (avahi-daemon)
+    board->hal.param.packet_wait_ns = eb_wait_for_packet_gap(connection, board->hal.param.packet_gap_ns);
+    if (board->hal.param.packet_wait_ns > board->hal.param.packet_wait_max_ns) {
+        board->hal.param.packet_wait_max_ns = board->hal.param.packet_wait_ns;
+    }
+}
+
+/**
+ * Sends a packet on all links to the board. The packet is considered to be sent when
+ * it has been sent on at least one link. The moment the packet has been sent on the
+ * first link is stored in `send_time` (optional).
+ */
+static int litexcnc_eth_sendv(litexcnc_eth_t *board, const struct iovec *iov, int iovcnt, struct timespec *send_time) {
+    int r = -1;
+    for (size_t i=0; i<board->link_count; i++) {
+        // Make sure the previous packet has been processed by the FPGA
+        litexcnc_eth_wait_for_packet_gap(board, board->links[i].connection);
+        if ((send_time != NULL) && (i == 0)) {
+            clock_gettime(CLOCK_MONOTONIC, send_time);
+        }
+        int sent = eb_sendv(board->links[i].connection, iov, iovcnt);
+        if (sent < 0) {
+            (*board->hal.pin.send_errors)++;
+            continue;
+        }
+        if (board->link_count > 1) {
+            (*board->links[i].hal.pin.packets_sent)++;
+        }
+        r = sent;
+    }
+    // The packet is counted once, regardless the number of links it has been sent on
+    if (r >= 0) {
+        (*board->hal.pin.packets_sent)++;
+    }
+    return r;
+}
+
+static void litexcnc_eth_reset_stats(litexcnc_eth_t *board) {
+    *board->hal.pin.packets_late = 0;
+    *board->hal.pin.packets_dropped = 0;
+    *board->hal.pin.packets_sent = 0;
+    *board->hal.pin.packets_received = 0;
+    *board->hal.pin.packets_short = 0;
+    *board->hal.pin.packets_malformed = 0;
+    *board->hal.pin.send_errors = 0;
+    *board->hal.pin.read_retries = 0;
+    *board->hal.pin.rtt_ns = 0;
+    *board->hal.pin.rtt_min_ns = 0;
+    *board->hal.pin.rtt_max_ns = 0;
+    *board->hal.pin.rtt_mean_ns = 0;
+    *board->hal.pin.rtt_p99_ns = 0;
+    for (size_t i=0; i<LITEXCNC_ETH_HISTOGRAM_BUCKETS; i++) {
+        *board->hal.pin.rtt_histogram[i] = 0;
+    }
+    memset(&board->stats, 0, sizeof(board->stats));
+    if (board->link_count > 1) {
+        for (size_t i=0; i<board->link_count; i++) {
+            *board->links[i].hal.pin.packets_sent = 0;
+            *board->links[i].hal.pin.packets_received = 0;
+            *board->links[i].hal.pin.packets_lost = 0;
+            *board->links[i].hal.pin.responses_first = 0;
+            *board->links[i].hal.pin.rtt_ns = 0;
+        }
+    }
+}
+
+static void litexcnc_eth_add_rtt(litexcnc_eth_t *board, int64_t rtt) {
+    if (rtt < 0) {
+        rtt = 0;
+    } else if (rtt > UINT32_MAX) {
+        rtt = UINT32_MAX;
+    }
+
+    // Last, minimum, maximum and mean
+    *board->hal.pin.rtt_ns = rtt;
+    if ((board->stats.rtt_count == 0) || (rtt < *board->hal.pin.rtt_min_ns)) {
+        *board->hal.pin.rtt_min_ns = rtt;
+    }
+    if (rtt > *board->hal.pin.rtt_max_ns) {
+        *board->hal.pin.rtt_max_ns = rtt;
+    }
+    board->stats.rtt_sum += rtt;
+    board->stats.rtt_count++;
+    *board->hal.pin.rtt_mean_ns = board->stats.rtt_sum / board->stats.rtt_count;
+
+    // Histogram, the last bucket contains all samples which don't fit in the others
+    size_t bucket = LITEXCNC_ETH_HISTOGRAM_BUCKETS - 1;
+    if (board->hal.param.rtt_bucket_ns > 0) {
+        bucket = rtt / board->hal.param.rtt_bucket_ns;
+        if (bucket >= LITEXCNC_ETH_HISTOGRAM_BUCKETS) {
+            bucket = LITEXCNC_ETH_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+    (*board->hal.pin.rtt_histogram[bucket])++;
+
+    // Sliding window, the oldest sample is replaced by the new sample
+    bucket = rtt / LITEXCNC_ETH_WINDOW_RESOLUTION_NS;
+    if (bucket >= LITEXCNC_ETH_WINDOW_BUCKETS) {
+        bucket = LITEXCNC_ETH_WINDOW_BUCKETS - 1;
+    }
+    if (board->stats.window_filled == LITEXCNC_ETH_WINDOW_SIZE) {
+        board->stats.window_buckets[board->stats.window[board->stats.window_index]]--;
+    } else {
+        board->stats.window_filled++;
+    }
+    board->stats.window[board->stats.window_index] = bucket;
+    board->stats.window_buckets[bucket]++;
+    board->stats.window_index = (board->stats.window_index + 1) % LITEXCNC_ETH_WINDOW_SIZE;
+
+    // 99th percentile: the upper bound of the bucket which contains the sample with 1%
+    // of the samples above it
+    size_t allowed = board->stats.window_filled / 100;
+    size_t above = 0;
+    for (size_t i=LITEXCNC_ETH_WINDOW_BUCKETS; i>0; i--) {
+        above += board->stats.window_buckets[i - 1];
+        if (above > allowed) {
+            *board->hal.pin.rtt_p99_ns = i * LITEXCNC_ETH_WINDOW_RESOLUTION_NS;
+            break;
+        }
+    }
+}
+
+static int64_t litexcnc_eth_timespec_ns(const struct timespec *ts) {
+    return (int64_t) ts->tv_sec * 1000000000L + ts->tv_nsec;
+}
+
+static uint32_t litexcnc_eth_clamp_u32(int64_t value) {
+    if (value < 0) {
+        return 0;
+    }
+    if (value > UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    return value;
+}
+
+static void litexcnc_eth_link_received(litexcnc_eth_t *board, size_t link, size_t fragment, bool previous) {
+    litexcnc_eth_link_t *eth_link = &board->links[link];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    (*eth_link->hal.pin.packets_received)++;
+    if (previous) {
+        eth_link->received_previous |= (1U << fragment);
+        *eth_link->hal.pin.rtt_ns = litexcnc_eth_clamp_u32(
+            litexcnc_eth_timespec_ns(&now) - litexcnc_eth_timespec_ns(&board->previous_request_time));
+    } else {
+        eth_link->received_current |= (1U << fragment);
+        *eth_link->hal.pin.rtt_ns = litexcnc_eth_clamp_u32(
+            litexcnc_eth_timespec_ns(&now) - litexcnc_eth_timespec_ns(&board->request_time));
+    }
+}
+
+static void litexcnc_eth_links_next_cycle(litexcnc_eth_t *board, uint32_t expected) {
+    // The responses to the previous request which have not arrived on a link by now,
+    // are considered lost on that link
+    for (size_t i=0; i<board->link_count; i++) {
+        litexcnc_eth_link_t *eth_link = &board->links[i];
+        if (board->links_started && (eth_link->received_previous != expected)) {
+            (*eth_link->hal.pin.packets_lost)++;
+        }
+        eth_link->received_previous = eth_link->received_current;
+        eth_link->received_current = 0;
+    }
+    board->links_started = true;
+}
+
+static void litexcnc_eth_process_timestamps(litexcnc_eth_t *board) {
+    litexcnc_fpga_t *this = &board->fpga;
+    uint32_t id;
+    struct timespec software, hardware, realtime, monotonic;
+
+    // Collect the timestamps of the packets sent since the previous cycle from the
+    // error queue of the socket
+    while (eb_get_tx_timestamp(board->connection, &id, &software, &hardware)) {
+        if (id == board->timestamps.request_id) {
+            board->timestamps.request_software = software;
+            board->timestamps.request_hardware = hardware;
+        }
+        if (id == board->timestamps.write_id) {
+            board->timestamps.write_software = software;
+        }
+    }
+    int64_t request_ns = litexcnc_eth_timespec_ns(&board->timestamps.request_software);
+    int64_t response_ns = litexcnc_eth_timespec_ns(&board->timestamps.response_software);
+    if ((request_ns == 0) || (response_ns == 0)) {
+        return;
+    }
+
+    // Round-trip time on the wire, preferably measured by the network card. This
+    // excludes the time the packets spent in the network stack of the host.
+    int64_t wire_rtt = response_ns - request_ns;
+    int64_t request_hw_ns = litexcnc_eth_timespec_ns(&board->timestamps.request_hardware);
+    int64_t response_hw_ns = litexcnc_eth_timespec_ns(&board->timestamps.response_hardware);
+    *board->hal.pin.hardware_timestamps = (request_hw_ns != 0) && (response_hw_ns != 0);
+    if (*board->hal.pin.hardware_timestamps) {
+        wire_rtt = response_hw_ns - request_hw_ns;
+    }
+    // The FPGA responds directly and the path is symmetrical, so the FPGA sampled the
+    // data halfway the round-trip
+    int64_t one_way = wire_rtt / 2;
+    *board->hal.pin.wire_rtt_ns = litexcnc_eth_clamp_u32(wire_rtt);
+    *board->hal.pin.one_way_ns = litexcnc_eth_clamp_u32(one_way);
+
+    // The software timestamps are in CLOCK_REALTIME, convert them to CLOCK_MONOTONIC
+    // which is used by the rest of the driver
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    int64_t offset = litexcnc_eth_timespec_ns(&monotonic) - litexcnc_eth_timespec_ns(&realtime);
+    *board->hal.pin.rx_latency_ns = litexcnc_eth_clamp_u32(litexcnc_eth_timespec_ns(&realtime) - response_ns);
+    int64_t sample_ns = response_ns + offset - one_way;
+
+    // Moment the data of the previous cycle arrived at the FPGA, relative to the moment
+    // the data processed in that cycle was sampled. The step generators assume the data
+    // is applied 0.75 period after the sample (compensated for the read lag).
+    int64_t write_ns = litexcnc_eth_timespec_ns(&board->timestamps.write_software);
+    if ((write_ns != 0) && (board->timestamps.previous_sample_ns != 0) && (this->period > 0)) {
+        *board->hal.pin.write_phase = 
+            (double) (write_ns + offset + one_way - board->timestamps.previous_sample_ns) / this->period
+            - this->read_lag;
+    }
+    memset(&board->timestamps.write_software, 0, sizeof(board->timestamps.write_software));
+    board->timestamps.previous_sample_ns = sample_ns;
+    this->read_timestamp_ns = sample_ns;
+    this->write_latency_ns = one_way;
+}
+
+// The cyclic data is split in fragments of at most EB_MAX_RECORD_WORDS words, as the
+// counts in an Etherbone record are a single byte. Each fragment is a separate packet.
+static size_t litexcnc_eth_fragment_words(size_t words, size_t fragment) {
+    size_t remaining = words - fragment * EB_MAX_RECORD_WORDS;
+    return (remaining > EB_MAX_RECORD_WORDS) ? EB_MAX_RECORD_WORDS : remaining;
+}
+
+static uint8_t *litexcnc_eth_read_request_packet(litexcnc_eth_t *board, size_t fragment) {
+    return board->read_request_buffer + fragment * LITEXCNC_ETH_READ_REQUEST_STRIDE;
+}
+
+static size_t litexcnc_eth_read_request_size(litexcnc_eth_t *board, size_t fragment) {
+    // A burst read only contains the first address of the fragment
+    if (board->burst) {
+        return 20;
+    }
+    return 16 + 4 * litexcnc_eth_fragment_words(board->read_words, fragment);
+}
+
+static void litexcnc_eth_next_sequence(litexcnc_eth_t *board) {
+    // The sequence number is stored in the base return address of the read request. The
+    // FPGA returns the base return address as the write address of the response, which 
+    // makes it possible to match the response with the request. The lowest byte contains
+    // the index of the fragment.
+    board->sequence = (board->sequence + 1) & 0xFFFFFF;
+    board->previous_request_time = board->request_time;
+    for (size_t i=0; i<board->read_fragments; i++) {
+        uint32_t tag = htobe32((board->sequence << 8) | i);
+        memcpy(litexcnc_eth_read_request_packet(board, i) + 12, &tag, sizeof(tag));
+    }
+}
+
+static void litexcnc_eth_set_request_id(litexcnc_eth_t *board) {
+    // The timestamps are retrieved when the response has been received
+    board->timestamps.request_id = eb_last_tx_id(board->connection);
+    memset(&board->timestamps.request_software, 0, sizeof(board->timestamps.request_software));
+    memset(&board->timestamps.request_hardware, 0, sizeof(board->timestamps.request_hardware));
+    memset(&board->timestamps.response_software, 0, sizeof(board->timestamps.response_software));
+    memset(&board->timestamps.response_hardware, 0, sizeof(board->timestamps.response_hardware));
+}
+
+static int litexcnc_eth_send_read_request(litexcnc_fpga_t *this) {
     litexcnc_eth_t *board = this->private;
     static int r;
-    
-    // This is essential as the colorlight card crashes when two packets come close to each other.
-	// This prevents crashes in the litex eth core. 
-	// Also turn of mDNS request from linux to the colorlight card. (avahi-daemon)
-	eb_wait_for_tx_buffer_empty(board->connection);
-
-    // Read the data (etherbone.h)
-    // - send request
-    r = eb_send(
-        board->connection,
-        board->read_request_buffer,
-        this->read_buffer_size);
-    if (r < 0) {
-        fprintf(stderr, "Could not write addresses to read to device `%s`, error code %d", this->name, r);
-        return -1;
+
+    litexcnc_eth_next_sequence(board);
+    for (size_t i=0; i<board->read_fragments; i++) {
+        // Send the addresses to read (etherbone.h). The round-trip time starts when the
+        // first packet is sent.
+        struct iovec iov = {
+            .iov_base = litexcnc_eth_read_request_packet(board, i),
+            .iov_len = litexcnc_eth_read_request_size(board, i)
+        };
+        r = litexcnc_eth_sendv(board, &iov, 1, (i == 0) ? &board->request_time : NULL);
+        if (r < 0) {
+            fprintf(stderr, "Could not write addresses to read to device `%s`, error code %d", this->name, r);
+            return -1;
+        }
+        if (board->timestamping && (i == 0)) {
+            litexcnc_eth_set_request_id(board);
+        }
     }
-    // - get response
-    int count = eb_recv(
+    board->response_pending = true;
+
+    return 0;
+}
+
+static int litexcnc_eth_read_request(litexcnc_fpga_t *this) {
+    litexcnc_eth_t *board = this->private;
+
+    // In combined or pipelined mode the request is already sent with the write
+    if (board->response_pending) {
+        return 0;
+    }
+    int r = litexcnc_eth_send_read_request(this);
+    // The request must be sent now, the response is collected by another function
+    eb_flush(board->connection);
+    return r;
+}
+
+static void litexcnc_eth_update_spin_time(litexcnc_eth_t *board, long spin_ns) {
+    board->hal.param.spin_time_ns = spin_ns;
+    if (board->hal.param.spin_time_ns > board->hal.param.spin_time_max_ns) {
+        board->hal.param.spin_time_max_ns = board->hal.param.spin_time_ns;
+    }
+}
+
+static int litexcnc_eth_receive(litexcnc_fpga_t *this, uint8_t *buffer, size_t size, int *link, long timeout_ns) {
+    litexcnc_eth_t *board = this->private;
+    int count;
+    long spin_ns;
+
+    // Spin for the response until half the period has passed after sending the
+    // request, leaving the remainder of the period for processing the data
+    long max_spin_ns = 0;
+    if (board->busy_poll) {
+        max_spin_ns = this->period / 2;
+    }
+
+    // The UDP sockets wait for the first response on any of the links. With redundant
+    // links this is the first response which arrives, with a single link the time to
+    // wait can differ per call.
+    *link = 0;
+#ifndef LITEXCNC_ETH_RAW
+    if (!board->io_uring) {
+        struct eb_connection *connections[LITEXCNC_ETH_MAX_LINKS];
+        for (size_t i=0; i<board->link_count; i++) {
+            connections[i] = board->links[i].connection;
+        }
+        count = eb_recv_any(connections, board->link_count, buffer, size, max_spin_ns, timeout_ns, link, &spin_ns);
+        if (board->busy_poll) {
+            litexcnc_eth_update_spin_time(board, spin_ns);
+        }
+        return count;
+    }
+#endif
+
+    // The io_uring and the raw transport cancel the receive when the timeout has passed,
+    // the time spent spinning is part of the timeout
+    eb_set_recv_timeout(board->connection, timeout_ns);
+    if (board->busy_poll) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t limit_ns = litexcnc_eth_timespec_ns(&now) - litexcnc_eth_timespec_ns(&board->request_time) + timeout_ns;
+        if (max_spin_ns > limit_ns) {
+            max_spin_ns = limit_ns;
+        }
+        count = eb_recv_spin(
+            board->connection,
+            buffer,
+            size,
+            max_spin_ns,
+            &spin_ns);
+        litexcnc_eth_update_spin_time(board, spin_ns);
+        return count;
+    }
+    return eb_recv(
         board->connection, 
-        this->read_buffer,
-        this->read_buffer_size);
-    // - check size is expexted size
-    if (count != this->read_buffer_size) {
-        fprintf(stderr, "Unexpected read length: %d, expected %zu\n", count, this->read_buffer_size);
-        return -1;
+        buffer,
+        size);
+}
+
+static long litexcnc_eth_retry_timeout_ns(litexcnc_fpga_t *this) {
+    litexcnc_eth_t *board = this->private;
+
+    // Without a retry the default timeout is used. With io_uring the receive is
+    // cancelled when the response has not arrived within the period, as it would be
+    // too late for this cycle anyway.
+    if ((board->hal.param.retry_fraction <= 0) || (this->period <= 0)) {
+        if (board->io_uring && (this->period > 0)) {
+            return this->period;
+        }
+        return EB_DEFAULT_RECV_TIMEOUT_NS;
+    }
+    double fraction = board->hal.param.retry_fraction;
+    if (fraction > 1.0) {
+        fraction = 1.0;
+    }
+    return (long) (fraction * this->period);
+}
+
+static int litexcnc_eth_retry_read_request(litexcnc_fpga_t *this, uint32_t received) {
+    litexcnc_eth_t *board = this->private;
+    int r;
+
+    // The read requests of the fragments which have not been received are sent again
+    // with the same sequence number, so the response to either request is accepted
+    for (size_t i=0; i<board->read_fragments; i++) {
+        if (received & (1U << i)) {
+            continue;
+        }
+        struct iovec iov = {
+            .iov_base = litexcnc_eth_read_request_packet(board, i),
+            .iov_len = litexcnc_eth_read_request_size(board, i)
+        };
+        r = litexcnc_eth_sendv(board, &iov, 1, (i == 0) ? &board->request_time : NULL);
+        if (r < 0) {
+            fprintf(stderr, "Could not write addresses to read to device `%s`, error code %d", this->name, r);
+            return -1;
+        }
+        if (board->timestamping && (i == 0)) {
+            litexcnc_eth_set_request_id(board);
+        }
+    }
+    eb_flush(board->connection);
+    (*board->hal.pin.read_retries)++;
+    return 0;
+}
+
+static int litexcnc_eth_read(litexcnc_fpga_t *this) {
+    litexcnc_eth_t *board = this->private;
+    
+    // In combined or pipelined mode the read request has already been sent at the end of
+    // the write of the previous cycle, or it has been sent by `read-request`. A request is
+    // only required here when no request is pending.
+    if (!board->response_pending) {
+        if (litexcnc_eth_send_read_request(this) < 0) {
+            return -1;
+        }
+    }
+    // When the request has been sent before this function is called, the response may
+    // have waited in the queue. The moment it is dequeued then does not give the RTT.
+    bool request_waited = board->response_pending;
+    board->response_pending = false;
+    this->read_timestamp_ns = 0;
+    if (*board->hal.pin.stats_reset) {
+        litexcnc_eth_reset_stats(board);
+    }
+    // With io_uring the packets are sent after they have been queued, failures are
+    // only known once their completion has been processed
+    for (size_t i=0; i<board->link_count; i++) {
+        *board->hal.pin.send_errors += eb_take_send_errors(board->links[i].connection);
+    }
+
+    // - get response. Responses to requests of earlier cycles, which arrived too late, are
+    //   discarded until the responses to the current request have been received. When the
+    //   data is split in fragments, the responses are received in a separate buffer and
+    //   the data is copied to its position in the read buffer.
+    int count;
+    int link;
+    uint32_t tag;
+    uint32_t received = 0;
+    uint32_t expected = (board->read_fragments == 32) ? 0xFFFFFFFF : ((1U << board->read_fragments) - 1);
+    uint8_t *buffer = this->read_buffer;
+    size_t size = this->read_buffer_size;
+    if (board->read_fragments > 1) {
+        buffer = board->fragment_buffer;
+        size = 16 + 4 * EB_MAX_RECORD_WORDS;
+    }
+    // When the response has not arrived before the deadline, the request is sent once
+    // more. The response must then arrive within the same time again.
+    struct timespec now;
+    struct timespec receive_time = {0};
+    long timeout_ns = litexcnc_eth_retry_timeout_ns(this);
+    bool retry = (board->hal.param.retry_fraction > 0) && (this->period > 0);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t deadline_ns = litexcnc_eth_timespec_ns(&now) + timeout_ns;
+    while (received != expected) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t remaining_ns = deadline_ns - litexcnc_eth_timespec_ns(&now);
+        count = litexcnc_eth_receive(this, buffer, size, &link, (remaining_ns > 0) ? remaining_ns : 0);
+        if ((count < 0) && retry && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            retry = false;
+            if (litexcnc_eth_retry_read_request(this, received) < 0) {
+                return -1;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            deadline_ns = litexcnc_eth_timespec_ns(&now) + timeout_ns;
+            continue;
+        }
+        if (count < 0) {
+            (*board->hal.pin.packets_dropped)++;
+            fprintf(stderr, "No response received from device `%s`\n", this->name);
+            if (board->link_count > 1) {
+                litexcnc_eth_links_next_cycle(board, expected);
+            }
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &receive_time);
+        (*board->hal.pin.packets_received)++;
+        if ((count < 16) || (buffer[0] != etherbone_header[0]) || (buffer[1] != etherbone_header[1])) {
+            (*board->hal.pin.packets_malformed)++;
+            continue;
+        }
+        memcpy(&tag, &buffer[12], sizeof(tag));
+        tag = be32toh(tag);
+        if ((tag >> 8) != board->sequence) {
+            // With redundant links, the response to the previous request on the slower
+            // link is expected and only counted for that link
+            if ((board->link_count > 1) && 
+                ((tag >> 8) == ((board->sequence - 1) & 0xFFFFFF)) &&
+                ((tag & 0xFF) < board->read_fragments)) {
+                litexcnc_eth_link_received(board, link, tag & 0xFF, true);
+                continue;
+            }
+            (*board->hal.pin.packets_late)++;
+            continue;
+        }
+        // - check size is expexted size
+        size_t fragment = tag & 0xFF;
+        if (fragment >= board->read_fragments) {
+            (*board->hal.pin.packets_malformed)++;
+            continue;
+        }
+        size_t words = litexcnc_eth_fragment_words(board->read_words, fragment);
+        if (count != 16 + 4 * words) {
+            // A valid copy may still arrive on another link or after the retry, the
+            // deadline decides whether the read has failed
+            (*board->hal.pin.packets_short)++;
+            continue;
+        }
+        if (board->link_count > 1) {
+            litexcnc_eth_link_received(board, link, fragment, false);
+            if (received & (1U << fragment)) {
+                // Already received on the other link
+                continue;
+            }
+            (*board->links[link].hal.pin.responses_first)++;
+        }
+        if (board->read_fragments > 1) {
+            memcpy(
+                this->read_buffer + this->read_header_size + 4 * fragment * EB_MAX_RECORD_WORDS,
+                buffer + 16,
+                4 * words);
+        }
+        // The moment the response has been received is compared with the moment the
+        // request of the first fragment has been sent
+        if (board->timestamping && (fragment == 0)) {
+            eb_get_rx_timestamp(
+                board->connection,
+                &board->timestamps.response_software,
+                &board->timestamps.response_hardware);
+        }
+        received |= (1U << fragment);
+    }
+    if (board->link_count > 1) {
+        litexcnc_eth_links_next_cycle(board, expected);
+    }
+    // The RTT is taken from the timestamps of the kernel when available, otherwise from
+    // the moment the last response has been dequeued. Without timestamps, responses which
+    // may have waited to be collected are left out of the statistics.
+    if (board->timestamping) {
+        litexcnc_eth_process_timestamps(board);
+        int64_t request_ns = litexcnc_eth_timespec_ns(&board->timestamps.request_software);
+        int64_t response_ns = litexcnc_eth_timespec_ns(&board->timestamps.response_software);
+        if ((request_ns != 0) && (response_ns != 0)) {
+            litexcnc_eth_add_rtt(board, response_ns - request_ns);
+        }
+    } else if (!request_waited) {
+        litexcnc_eth_add_rtt(
+            board,
+            litexcnc_eth_timespec_ns(&receive_time) - litexcnc_eth_timespec_ns(&board->request_time));
+        // Without timestamps the FPGA is assumed to have sampled the data halfway the
+        // round-trip.
+        this->write_latency_ns = *board->hal.pin.rtt_ns / 2;
+        this->read_timestamp_ns = 
+            (int64_t) board->request_time.tv_sec * 1000000000L + board->request_time.tv_nsec + this->write_latency_ns;
     }
     
     // Successful read
     return 0;
 }
 
+/*******************************************************************************
+ * Writes only the runs of the write buffer which have changed since the previous
+ * write. Each run is sent as a separate record with its own header, runs longer
+ * than a record are split. Because each packet has a considerable overhead, the
+ * runs are only written when they require no more packets than writing the
+ * complete buffer.
+ *
+ * @param this    Pointer to the FPGA to write the data to.
+ * @return        1 when the runs have been written, 0 when the complete buffer
+ *                has to be written and -1 when sending has failed.
+ ******************************************************************************/
+static int litexcnc_eth_write_runs(litexcnc_fpga_t *this) {
+    litexcnc_eth_t *board = this->private;
+    size_t packets = 0;
+    int r;
+
+    if (this->write_run_count == 0) {
+        return 0;
+    }
+    for (size_t i=0; i<this->write_run_count; i++) {
+        packets += ((this->write_runs[i].size >> 2) + EB_MAX_RECORD_WORDS - 1) / EB_MAX_RECORD_WORDS;
+    }
+    if (packets > board->write_fragments) {
+        return 0;
+    }
+
+    uint8_t *header = board->write_run_headers;
+    for (size_t i=0; i<this->write_run_count; i++) {
+        size_t words = this->write_runs[i].size >> 2;
+        for (size_t j=0; j*EB_MAX_RECORD_WORDS<words; j++) {
+            size_t offset = this->write_runs[i].offset + 4 * j * EB_MAX_RECORD_WORDS;
+            uint32_t address = htobe32(this->write_base_address + offset);
+            header[10] = litexcnc_eth_fragment_words(words, j);
+            memcpy(&header[12], &address, sizeof(address));
+            struct iovec iov[2] = {
+                {.iov_base = header,
+                 .iov_len = 16},
+                {.iov_base = this->write_buffer + this->write_header_size + offset,
+                 .iov_len = 4 * header[10]}
+            };
+            r = litexcnc_eth_sendv(board, iov, 2, NULL);
+            if (r < 0) {
+                fprintf(stderr, "Could not write data to device `%s`, error code %d", this->name, r);
+                return -1;
+            }
+            header += 16;
+        }
+    }
+    return 1;
+}
+
+
 static int litexcnc_eth_write(litexcnc_fpga_t *this) {
     litexcnc_eth_t *board = this->private;
     static int r;
-    
-    // This is essential as the colorlight card crashes when two packets come close
-    // to each other. This prevents crashes in the litex eth core. 
-	// Also turn of mDNS request from linux to the colorlight card. (avahi-daemon)
-	eb_wait_for_tx_buffer_empty(board->connection);
-
-    // Write the data (etberbone.h)
-    r = eb_send(
-        board->connection,
-        this->write_buffer,
-        this->write_buffer_size);
+
+    if (board->transfer_mode == LITEXCNC_ETH_TRANSFER_COMBINED) {
+        // Append the read request (base return address and addresses to read) to
+        // the write record. The response is collected in the next read cycle.
+        litexcnc_eth_next_sequence(board);
+        struct iovec iov[2] = {
+            {.iov_base = this->write_buffer,                .iov_len = this->write_buffer_size},
+            {.iov_base = board->read_request_buffer + 12,   .iov_len = litexcnc_eth_read_request_size(board, 0) - 12}
+        };
+        r = litexcnc_eth_sendv(board, iov, 2, &board->request_time);
+        if (r < 0) {
+            fprintf(stderr, "Could not write data to device `%s`, error code %d", this->name, r);
+            return -1;
+        }
+        if (board->timestamping) {
+            litexcnc_eth_set_request_id(board);
+            board->timestamps.write_id = board->timestamps.request_id;
+        }
+        board->response_pending = true;
+        eb_flush(board->connection);
+        return r;
+    }
+
+    // Write the data (etberbone.h), each fragment with its own header. When only a part
+    // of the data has changed, only the changed runs are written.
+    r = litexcnc_eth_write_runs(this);
     if (r < 0) {
-        fprintf(stderr, "Could not write data to device `%s`, error code %d", this->name, r);
         return -1;
     }
+    if (r == 0) {
+        for (size_t i=0; i<board->write_fragments; i++) {
+            struct iovec iov[2] = {
+                {.iov_base = board->write_fragment_headers + 16 * i, 
+                 .iov_len = 16},
+                {.iov_base = this->write_buffer + this->write_header_size + 4 * i * EB_MAX_RECORD_WORDS, 
+                 .iov_len = 4 * litexcnc_eth_fragment_words(board->write_words, i)}
+            };
+            r = litexcnc_eth_sendv(board, iov, 2, NULL);
+            if (r < 0) {
+                fprintf(stderr, "Could not write data to device `%s`, error code %d", this->name, r);
+                return -1;
+            }
+        }
+    }
+    if (board->timestamping) {
+        board->timestamps.write_id = eb_last_tx_id(board->connection);
+    }
 
-    // If we missed a paket earlier with timeout AND this packet arrives later, there 
-    // can be a queue of packet. Test here if anoter packet is ready ( no delay) and 
-    // discard that packet to avoid such a queue.
-	//eb_discard_pending_packet(board->connection, this->write_buffer_size);
+    // In pipelined mode the read request for the next cycle is sent directly after the
+    // write. The response arrives while the servo thread is idle, so the next read only
+    // has to collect it from the socket.
+    if (board->pipelined) {
+        if (litexcnc_eth_send_read_request(this) < 0) {
+            return -1;
+        }
+    }
 
+    // Packets queued in the io_uring are submitted together
+    eb_flush(board->connection);
     return r;
 }
 
@@ -188,25 +822,202 @@ static int litexcnc_eth_write(litexcnc_fpga_t *this) {
 static int connect_board(litexcnc_eth_t *board, char *connection_string) {
     
     char port_default[5] = "1234";
-    char *port_ptr;
+    char value[16];
 
-    // Check whether the connection string contains a colon (:), which indicates
-    // the port number. If a port number is specified, it is split from the 
-    // connection string and stored separately
-    port_ptr = strchr(connection_string, ':'); // Find first ',' starting from 'p'
-    if (port_ptr != NULL) {
-        *port_ptr = '\0';          // Replace ':' with a null terminator
-        ++port_ptr;                // Move port pointer forward
-    } else {
-        port_ptr = port_default;
+    // Split the options (i.e. `?transfer=combined`) from the connection string
+    char *options = litexcnc_split_options(connection_string);
+    board->transfer_mode = LITEXCNC_ETH_TRANSFER_SEPARATE;
+    if (litexcnc_get_option(options, "transfer", value, sizeof(value))) {
+        if (strcmp(value, "combined") == 0) {
+            board->transfer_mode = LITEXCNC_ETH_TRANSFER_COMBINED;
+            // The data read is collected when the previous cycle is written 
+            board->fpga.read_lag = 1;
+        } else if (strcmp(value, "separate") != 0) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: unknown transfer mode '%s'\n", value);
+            return -1;
+        }
+    }
+    board->pipelined = false;
+    if (litexcnc_get_option(options, "pipeline", value, sizeof(value))) {
+        board->pipelined = (atoi(value) != 0);
+        if (board->pipelined) {
+            // The data read is collected when the previous cycle is written 
+            board->fpga.read_lag = 1;
+        }
+    }
+    board->busy_poll = false;
+    if (litexcnc_get_option(options, "poll", value, sizeof(value))) {
+        if (strcmp(value, "busy") == 0) {
+            board->busy_poll = true;
+        } else if (strcmp(value, "block") != 0) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: unknown poll mode '%s'\n", value);
+            return -1;
+        }
+    }
+    board->burst = false;
+    if (litexcnc_get_option(options, "burst", value, sizeof(value))) {
+        // Requires the firmware to be built with `burst_read` enabled
+        board->burst = (atoi(value) != 0);
+    }
+    board->io_uring = false;
+#ifdef LITEXCNC_ETH_RAW
+    if (litexcnc_get_option(options, "io", value, sizeof(value))) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-ethraw: ERROR: the option 'io' is not supported by the raw transport\n");
+        return -1;
+    }
+#else
+    int sqpoll = 0;
+    if (litexcnc_get_option(options, "io", value, sizeof(value))) {
+        if (strcmp(value, "uring") == 0) {
+            board->io_uring = true;
+        } else if (strcmp(value, "sqpoll") == 0) {
+            board->io_uring = true;
+            sqpoll = 1;
+        } else if (strcmp(value, "socket") != 0) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: unknown io mode '%s'\n", value);
+            return -1;
+        }
+    }
+#endif
+    board->timestamping = LITEXCNC_ETH_TIMESTAMPS_NONE;
+    if (litexcnc_get_option(options, "timestamps", value, sizeof(value))) {
+        if (strcmp(value, "software") == 0) {
+            board->timestamping = LITEXCNC_ETH_TIMESTAMPS_SOFTWARE;
+        } else if (strcmp(value, "hardware") == 0) {
+            board->timestamping = LITEXCNC_ETH_TIMESTAMPS_HARDWARE;
+        } else if (strcmp(value, "none") != 0) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: unknown timestamps mode '%s'\n", value);
+            return -1;
+        }
+    }
+
+#ifdef LITEXCNC_ETH_RAW
+    if (board->timestamping) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-ethraw: ERROR: timestamps are not supported by the raw transport\n");
+        return -1;
+    }
+
+    // The connection string contains the interface and the MAC-address of the board,
+    // separated by a comma. The IP-address and the port are given as options.
+    char ip[16];
+    char port[6];
+    char *mac_ptr = strchr(connection_string, ',');
+    if (mac_ptr == NULL) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-ethraw: ERROR: connection string should be '<ifname>,<mac>', got '%s'\n", connection_string);
+        return -1;
+    }
+    *mac_ptr = '\0';
+    ++mac_ptr;
+    if (!litexcnc_get_option(options, "ip", ip, sizeof(ip))) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-ethraw: ERROR: the IP-address of the board is required (option 'ip')\n");
+        return -1;
+    }
+    if (!litexcnc_get_option(options, "port", port, sizeof(port))) {
+        strcpy(port, port_default);
     }
 
-    board->connection = eb_connect(connection_string, port_ptr, 1);
+    board->connection = eb_connect_raw(connection_string, mac_ptr, ip, port);
     if (!board->connection) {
-        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: failed to connect to board on '%s:%s'\n", connection_string, port_ptr);
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-ethraw: ERROR: failed to connect to board %s on '%s'\n", mac_ptr, connection_string);
         return -1;
     }
-    rtapi_print("LitexCNC-eth: connected to board on '%s:%s'\n", connection_string, port_ptr);
+    board->links[0].connection = board->connection;
+    board->link_count = 1;
+    rtapi_print("LitexCNC-ethraw: connected to board %s (%s:%s) on '%s'\n", mac_ptr, ip, port, connection_string);
+#else
+    char *port_ptr;
+
+    // The port on which the responses are received can differ from the port of the 
+    // board, which is required when the board is emulated on the same host
+    char rx_port[6];
+    char *rx_port_ptr = NULL;
+    if (litexcnc_get_option(options, "rx_port", rx_port, sizeof(rx_port))) {
+        rx_port_ptr = rx_port;
+    }
+
+    // The board can be connected with redundant links, of which the addresses are
+    // separated by a pipe (|). The responses of each link are then received on the
+    // interface of that link only.
+    board->link_count = 0;
+    bool redundant = (strchr(connection_string, '|') != NULL);
+    char *next_link = connection_string;
+    while (next_link != NULL) {
+        char *address = next_link;
+        next_link = strchr(address, '|');
+        if (next_link != NULL) {
+            *next_link = '\0';
+            ++next_link;
+        }
+        if (board->link_count == LITEXCNC_ETH_MAX_LINKS) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: at most %d links to a board are supported\n", LITEXCNC_ETH_MAX_LINKS);
+            return -1;
+        }
+
+        // Check whether the connection string contains a colon (:), which indicates
+        // the port number. If a port number is specified, it is split from the 
+        // connection string and stored separately
+        port_ptr = strchr(address, ':'); // Find first ',' starting from 'p'
+        if (port_ptr != NULL) {
+            *port_ptr = '\0';          // Replace ':' with a null terminator
+            ++port_ptr;                // Move port pointer forward
+        } else {
+            port_ptr = port_default;
+        }
+
+        if (redundant) {
+            board->links[board->link_count].connection = eb_connect_bound(address, port_ptr, rx_port_ptr);
+        } else {
+            board->links[board->link_count].connection = eb_connect(address, port_ptr, rx_port_ptr, 1);
+        }
+        if (!board->links[board->link_count].connection) {
+            rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: failed to connect to board on '%s:%s'\n", address, port_ptr);
+            return -1;
+        }
+        rtapi_print("LitexCNC-eth: connected to board on '%s:%s'\n", address, port_ptr);
+        board->link_count++;
+    }
+    board->connection = board->links[0].connection;
+    if ((board->link_count > 1) && (board->io_uring || board->timestamping)) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: io_uring and timestamps are not supported with redundant links\n");
+        return -1;
+    }
+
+    if (board->io_uring) {
+        if (eb_setup_io_uring(board->connection, sqpoll) < 0) {
+            // The sockets are still usable, only with a system call for each packet
+            rtapi_print_msg(RTAPI_MSG_WARN,"LitexCNC-eth: WARNING: unable to set up io_uring, using the sockets directly: %s\n", strerror(errno));
+            board->io_uring = false;
+        }
+    }
+
+    if (board->timestamping) {
+        // The timestamps are retrieved from the sockets with separate system calls,
+        // which defeats the purpose of the io_uring
+        int r = -1;
+        if (board->io_uring) {
+            errno = EINVAL;
+        } else {
+            r = eb_enable_timestamping(board->connection, board->timestamping == LITEXCNC_ETH_TIMESTAMPS_HARDWARE);
+        }
+        if (r < 0) {
+            rtapi_print_msg(RTAPI_MSG_WARN,"LitexCNC-eth: WARNING: unable to enable timestamping of the packets: %s\n", strerror(errno));
+            board->timestamping = LITEXCNC_ETH_TIMESTAMPS_NONE;
+        } else if ((r == 0) && (board->timestamping == LITEXCNC_ETH_TIMESTAMPS_HARDWARE)) {
+            rtapi_print_msg(RTAPI_MSG_WARN,"LitexCNC-eth: WARNING: hardware timestamps are not available, using software timestamps\n");
+            board->timestamping = LITEXCNC_ETH_TIMESTAMPS_SOFTWARE;
+        }
+    }
+#endif
+
+    if (board->busy_poll) {
+        for (size_t i=0; i<board->link_count; i++) {
+            if (eb_set_busy_poll(board->links[i].connection, EB_DEFAULT_BUSY_POLL_US) < 0) {
+                // Spinning on the socket still reduces the latency, only the kernel won't
+                // poll the network card
+                rtapi_print_msg(RTAPI_MSG_WARN,"LitexCNC-eth: WARNING: unable to enable busy polling on the socket: %s\n", strerror(errno));
+            }
+        }
+    }
 
     return 0;
 }
@@ -215,44 +1026,180 @@ static int connect_board(litexcnc_eth_t *board, char *connection_string) {
 static int litexcnc_init_buffers(litexcnc_fpga_t *this) {
     litexcnc_eth_t *board = this->private;
 
+    // Determine the number of fragments (in WORD-count, bitshift to divide by 4)
+    board->write_words = (board->fpga.write_buffer_size - board->fpga.write_header_size) >> 2;
+    board->write_fragments = (board->write_words + EB_MAX_RECORD_WORDS - 1) / EB_MAX_RECORD_WORDS;
+    board->read_words = (board->fpga.read_buffer_size - board->fpga.read_header_size) >> 2;
+    board->read_fragments = (board->read_words + EB_MAX_RECORD_WORDS - 1) / EB_MAX_RECORD_WORDS;
+    if (board->read_fragments > LITEXCNC_ETH_MAX_FRAGMENTS) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: too much data to read (%zu words)\n", board->read_words);
+        return -1;
+    }
+    if ((board->transfer_mode == LITEXCNC_ETH_TRANSFER_COMBINED) && 
+        ((board->write_fragments > 1) || (board->read_fragments > 1))) {
+        rtapi_print_msg(RTAPI_MSG_ERR,"LitexCNC-eth: ERROR: combined transfer requires at most %d words to read and write\n", EB_MAX_RECORD_WORDS);
+        return -1;
+    }
+
     // Initialize the buffers with headers
-    size_t words;
+    uint32_t address;
     //  - WRITE BUFFER
     memcpy(board->fpga.write_buffer, etherbone_header, sizeof(etherbone_header));
-    // - size (in WORD-count, bitshift to divide by 4)
-    words =  (board->fpga.write_buffer_size - board->fpga.read_header_size) >> 2;
-    board->fpga.write_buffer[10] = words;
+    // - size
+    board->fpga.write_buffer[10] = litexcnc_eth_fragment_words(board->write_words, 0);
     // - address
-    uint32_t address = htobe32(board->fpga.write_base_address);
+    address = htobe32(board->fpga.write_base_address);
     memcpy(&board->fpga.write_buffer[12], &address, sizeof(address));
+    // - in combined mode the same record also contains the reads 
+    if (board->transfer_mode == LITEXCNC_ETH_TRANSFER_COMBINED) {
+        board->fpga.write_buffer[11] = board->read_words;
+        if (board->burst) {
+            board->fpga.write_buffer[8] |= EB_RECORD_FLAG_BURST_READ;
+        }
+    }
 
-    // - REQUEST BUFFER 
-    uint8_t *read_request_buffer = rtapi_kmalloc(board->fpga.read_buffer_size, RTAPI_GFP_KERNEL);
-    memcpy(read_request_buffer, etherbone_header, sizeof(etherbone_header));
-    // - size (in WORD-count, bitshift to divide by 4)
-    words = (board->fpga.read_buffer_size - board->fpga.read_header_size) >> 2; 
-    read_request_buffer[11] = words; 
-    // - addresses
-    uint32_t addresses[words];
-    for (size_t i=0; i<words; i++) {
-        addresses[i] = htobe32(board->fpga.read_base_address + (i << 2));
-    }
-    memcpy(&read_request_buffer[16], addresses, words * 4);
-    // Store the created buffer
-    board->read_request_buffer = read_request_buffer;
+    // - WRITE HEADERS, one for each fragment
+    board->write_fragment_headers = rtapi_kmalloc(16 * board->write_fragments, RTAPI_GFP_KERNEL);
+    for (size_t i=0; i<board->write_fragments; i++) {
+        uint8_t *header = board->write_fragment_headers + 16 * i;
+        memcpy(header, etherbone_header, sizeof(etherbone_header));
+        header[10] = litexcnc_eth_fragment_words(board->write_words, i);
+        address = htobe32(board->fpga.write_base_address + 4 * i * EB_MAX_RECORD_WORDS);
+        memcpy(&header[12], &address, sizeof(address));
+    }
+
+    // - RUN HEADERS, for sparse writes. A sparse write never uses more packets than the
+    //   fragments of the complete buffer. The size and address are set when writing.
+    board->write_run_headers = rtapi_kmalloc(16 * board->write_fragments, RTAPI_GFP_KERNEL);
+    for (size_t i=0; i<board->write_fragments; i++) {
+        memcpy(board->write_run_headers + 16 * i, etherbone_header, sizeof(etherbone_header));
+    }
+
+    // - REQUEST BUFFER, containing a packet for each fragment
+    board->read_request_buffer_size = board->read_fragments * LITEXCNC_ETH_READ_REQUEST_STRIDE;
+    board->read_request_buffer = rtapi_kmalloc(board->read_request_buffer_size, RTAPI_GFP_KERNEL);
+    for (size_t i=0; i<board->read_fragments; i++) {
+        uint8_t *packet = litexcnc_eth_read_request_packet(board, i);
+        size_t words = litexcnc_eth_fragment_words(board->read_words, i);
+        memcpy(packet, etherbone_header, sizeof(etherbone_header));
+        packet[11] = words; 
+        // - addresses, a burst read only requires the first address
+        if (board->burst) {
+            packet[8] |= EB_RECORD_FLAG_BURST_READ;
+            address = htobe32(board->fpga.read_base_address + 4 * i * EB_MAX_RECORD_WORDS);
+            memcpy(&packet[16], &address, sizeof(address));
+            continue;
+        }
+        for (size_t j=0; j<words; j++) {
+            address = htobe32(board->fpga.read_base_address + 4 * (i * EB_MAX_RECORD_WORDS + j));
+            memcpy(&packet[16 + 4 * j], &address, sizeof(address));
+        }
+    }
+
+    // - FRAGMENT BUFFER, for receiving the responses when the data is fragmented
+    board->fragment_buffer = rtapi_kmalloc(16 + 4 * EB_MAX_RECORD_WORDS, RTAPI_GFP_KERNEL);
+
+    // Register the buffers with the io_uring, so they are not mapped for every packet
+    if (board->io_uring) {
+        struct iovec buffers[5] = {
+            {.iov_base = board->fpga.write_buffer,        .iov_len = board->fpga.write_buffer_size},
+            {.iov_base = board->fpga.read_buffer,         .iov_len = board->fpga.read_buffer_size},
+            {.iov_base = board->read_request_buffer,      .iov_len = board->read_request_buffer_size},
+            {.iov_base = board->write_fragment_headers,   .iov_len = 16 * board->write_fragments},
+            {.iov_base = board->fragment_buffer,          .iov_len = 16 + 4 * EB_MAX_RECORD_WORDS},
+        };
+        if (eb_register_buffers(board->connection, buffers, 5) < 0) {
+            rtapi_print_msg(RTAPI_MSG_WARN,"LitexCNC-eth: WARNING: unable to register buffers with io_uring: %s\n", strerror(errno));
+        }
+    }
     
     return 0;
 }
 
 
+// Creation of a pin of the board, the name of the pin is appended to the name of the board
+#define LITEXCNC_ETH_CREATE_HAL_PIN(pin_name, type, direction, parameter) \
+    r = hal_pin_## type ##_newf(direction, parameter, board->fpga.comp_id, "%s." pin_name, board->fpga.name); \
+    if (r < 0) { LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s." pin_name "', aborting\n", board->fpga.name); return r; }
+
+// Creation of a pin of a link to the board, i.e. `<board>.link.<n>.<pin_name>`
+#define LITEXCNC_ETH_CREATE_LINK_PIN(pin_name, parameter) \
+    r = hal_pin_u32_newf(HAL_OUT, parameter, board->fpga.comp_id, "%s.link.%zu." pin_name, board->fpga.name, i); \
+    if (r < 0) { LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.link.%zu." pin_name "', aborting\n", board->fpga.name, i); return r; }
+
+static int litexcnc_eth_init_stats(litexcnc_eth_t *board) {
+    int r;
+
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_late", u32, HAL_OUT, &(board->hal.pin.packets_late))
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_dropped", u32, HAL_OUT, &(board->hal.pin.packets_dropped))
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_sent", u32, HAL_OUT, &(board->hal.pin.packets_sent))
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_received", u32, HAL_OUT, &(board->hal.pin.packets_received))
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_short", u32, HAL_OUT, &(board->hal.pin.packets_short))
+    LITEXCNC_ETH_CREATE_HAL_PIN("packets_malformed", u32, HAL_OUT, &(board->hal.pin.packets_malformed))
+    LITEXCNC_ETH_CREATE_HAL_PIN("send_errors", u32, HAL_OUT, &(board->hal.pin.send_errors))
+    LITEXCNC_ETH_CREATE_HAL_PIN("read_retries", u32, HAL_OUT, &(board->hal.pin.read_retries))
+    LITEXCNC_ETH_CREATE_HAL_PIN("rtt_ns", u32, HAL_OUT, &(board->hal.pin.rtt_ns))
+    LITEXCNC_ETH_CREATE_HAL_PIN("rtt_min_ns", u32, HAL_OUT, &(board->hal.pin.rtt_min_ns))
+    LITEXCNC_ETH_CREATE_HAL_PIN("rtt_max_ns", u32, HAL_OUT, &(board->hal.pin.rtt_max_ns))
+    LITEXCNC_ETH_CREATE_HAL_PIN("rtt_mean_ns", u32, HAL_OUT, &(board->hal.pin.rtt_mean_ns))
+    LITEXCNC_ETH_CREATE_HAL_PIN("rtt_p99_ns", u32, HAL_OUT, &(board->hal.pin.rtt_p99_ns))
+    LITEXCNC_ETH_CREATE_HAL_PIN("stats_reset", bit, HAL_IN, &(board->hal.pin.stats_reset))
+    for (size_t i=0; i<LITEXCNC_ETH_HISTOGRAM_BUCKETS; i++) {
+        r = hal_pin_u32_newf(HAL_OUT, &(board->hal.pin.rtt_histogram[i]), board->fpga.comp_id, "%s.rtt_histogram.%02zu", board->fpga.name, i);
+        if (r < 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.rtt_histogram.%02zu', aborting\n", board->fpga.name, i);
+            return r;
+        }
+    }
+    r = hal_param_u32_newf(HAL_RW, &(board->hal.param.rtt_bucket_ns), board->fpga.comp_id, "%s.rtt_bucket_ns", board->fpga.name);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.rtt_bucket_ns', aborting\n", board->fpga.name);
+        return r;
+    }
+    board->hal.param.rtt_bucket_ns = LITEXCNC_ETH_DEFAULT_BUCKET_NS;
+    r = hal_param_float_newf(HAL_RW, &(board->hal.param.retry_fraction), board->fpga.comp_id, "%s.retry_fraction", board->fpga.name);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.retry_fraction', aborting\n", board->fpga.name);
+        return r;
+    }
+    board->hal.param.retry_fraction = LITEXCNC_ETH_DEFAULT_RETRY_FRACTION;
+
+    // Statistics for each link, only when the board is connected with redundant links
+    if (board->link_count > 1) {
+        for (size_t i=0; i<board->link_count; i++) {
+            litexcnc_eth_link_t *link = &board->links[i];
+            LITEXCNC_ETH_CREATE_LINK_PIN("packets_sent", &(link->hal.pin.packets_sent))
+            LITEXCNC_ETH_CREATE_LINK_PIN("packets_received", &(link->hal.pin.packets_received))
+            LITEXCNC_ETH_CREATE_LINK_PIN("packets_lost", &(link->hal.pin.packets_lost))
+            LITEXCNC_ETH_CREATE_LINK_PIN("responses_first", &(link->hal.pin.responses_first))
+            LITEXCNC_ETH_CREATE_LINK_PIN("rtt_ns", &(link->hal.pin.rtt_ns))
+        }
+    }
+
+    // The pins for the timestamps are only created when timestamping is enabled
+    if (board->timestamping) {
+        LITEXCNC_ETH_CREATE_HAL_PIN("timestamps.wire_rtt_ns", u32, HAL_OUT, &(board->hal.pin.wire_rtt_ns))
+        LITEXCNC_ETH_CREATE_HAL_PIN("timestamps.one_way_ns", u32, HAL_OUT, &(board->hal.pin.one_way_ns))
+        LITEXCNC_ETH_CREATE_HAL_PIN("timestamps.rx_latency_ns", u32, HAL_OUT, &(board->hal.pin.rx_latency_ns))
+        LITEXCNC_ETH_CREATE_HAL_PIN("timestamps.write_phase", float, HAL_OUT, &(board->hal.pin.write_phase))
+        LITEXCNC_ETH_CREATE_HAL_PIN("timestamps.hardware", bit, HAL_OUT, &(board->hal.pin.hardware_timestamps))
+    }
+
+    return 0;
+}
+
+
 static int close_connection(litexcnc_eth_t *board) {
+    for (size_t i=1; i<board->link_count; i++) {
+        eb_disconnect(&board->links[i].connection);
+    }
     eb_disconnect(&board->connection);
     return 0;
 }
 
 
 static int initialize_driver(char *connection_string, int comp_id) {
-    size_t ret;
+    int ret;
     boards[boards_count] = (litexcnc_eth_t *)hal_malloc(sizeof(litexcnc_eth_t));
     ret = connect_board(boards[boards_count], connection_string);
     if (ret < 0) return ret;
@@ -260,10 +1207,12 @@ static int initialize_driver(char *connection_string, int comp_id) {
     boards[boards_count]->fpga.comp_id           = comp_id;
     boards[boards_count]->fpga.read_n_bits       = litexcnc_eth_read_n_bits;
     boards[boards_count]->fpga.read              = litexcnc_eth_read;
+    boards[boards_count]->fpga.read_request      = litexcnc_eth_read_request;
     boards[boards_count]->fpga.read_header_size  = 16;
     boards[boards_count]->fpga.write_n_bits      = litexcnc_eth_write_n_bits;
     boards[boards_count]->fpga.write             = litexcnc_eth_write;
     boards[boards_count]->fpga.write_header_size = 16;
+    boards[boards_count]->fpga.sparse_write      = (boards[boards_count]->transfer_mode != LITEXCNC_ETH_TRANSFER_COMBINED);
     boards[boards_count]->fpga.private           = boards[boards_count];
     // Register the board with the main function
     ret = litexcnc_register(&boards[boards_count]->fpga);
@@ -277,6 +1226,41 @@ static int initialize_driver(char *connection_string, int comp_id) {
         LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.debug', aborting\n", boards[boards_count]->fpga.name);
         return ret;
     }
+    // Create the params for the pacing of the packets
+    ret = hal_param_u32_newf(HAL_RW, &(boards[boards_count]->hal.param.packet_gap_ns), comp_id, "%s.packet_gap_ns", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.packet_gap_ns', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
+    boards[boards_count]->hal.param.packet_gap_ns = EB_DEFAULT_PACKET_GAP_NS;
+    ret = hal_param_u32_newf(HAL_RO, &(boards[boards_count]->hal.param.packet_wait_ns), comp_id, "%s.packet_wait_ns", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.packet_wait_ns', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
+    ret = hal_param_u32_newf(HAL_RW, &(boards[boards_count]->hal.param.packet_wait_max_ns), comp_id, "%s.packet_wait_max_ns", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.packet_wait_max_ns', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
+    // Create the pins and params for the statistics of the packets
+    ret = litexcnc_eth_init_stats(boards[boards_count]);
+    if (ret < 0) {
+        return ret;
+    }
+    // Create the params for the time spent on busy polling
+    if (boards[boards_count]->busy_poll) {
+        ret = hal_param_u32_newf(HAL_RO, &(boards[boards_count]->hal.param.spin_time_ns), comp_id, "%s.spin_time_ns", boards[boards_count]->fpga.name);
+        if (ret < 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.spin_time_ns', aborting\n", boards[boards_count]->fpga.name);
+            return ret;
+        }
+        ret = hal_param_u32_newf(HAL_RW, &(boards[boards_count]->hal.param.spin_time_max_ns), comp_id, "%s.spin_time_max_ns", boards[boards_count]->fpga.name);
+        if (ret < 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.spin_time_max_ns', aborting\n", boards[boards_count]->fpga.name);
+            return ret;
+        }
+    }
     // Create the pins for the board and write headers to the buffers
     ret = litexcnc_init_buffers(&boards[boards_count]->fpga);
     if (ret != 0) {
@@ -290,12 +1274,12 @@ static int initialize_driver(char *connection_string, int comp_id) {
 
 
 int rtapi_app_main(void) {
-    LITEXCNC_ERR_NO_DEVICE("ERROR: Direct usage of the module `litexcnc_eth` is not supported\n");
+    LITEXCNC_ERR_NO_DEVICE("ERROR: Direct usage of the module `" LITEXCNC_ETH_NAME "` is not supported\n");
     LITEXCNC_ERR_NO_DEVICE("This is caused by the following loadrt-commands in your HAL-file:\n");
     LITEXCNC_ERR_NO_DEVICE("    loadrt litexcnc\n");
-    LITEXCNC_ERR_NO_DEVICE("    loadrt litexcnc_eth connection_string=\"%s\"\n", connection_string[0]);
+    LITEXCNC_ERR_NO_DEVICE("    loadrt " LITEXCNC_ETH_NAME " connection_string=\"%s\"\n", connection_string[0]);
     LITEXCNC_ERR_NO_DEVICE("Please use the folllowing single command in your hal-file instead:\n");
-    LITEXCNC_ERR_NO_DEVICE("    loadrt litexcnc connections=\"eth:%s\"\n", connection_string[0]);
+    LITEXCNC_ERR_NO_DEVICE("    loadrt litexcnc connections=\"" LITEXCNC_ETH_DRIVER ":%s\"\n", connection_string[0]);
     LITEXCNC_ERR_NO_DEVICE("For more information, see: https://github.com/Peter-van-Tol/LiteX-CNC/issues/32 \n");
     LITEXCNC_ERR_NO_DEVICE("Stopping LinuxCNC now!\n");
     return -1;
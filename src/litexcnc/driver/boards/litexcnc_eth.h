@@ -18,23 +18,161 @@
 #ifndef __INCLUDE_LITEXCNC_ETH_H__
 #define __INCLUDE_LITEXCNC_ETH_H__
 
+#ifdef LITEXCNC_ETH_RAW
+// Raw Ethernet variant of the driver (see litexcnc_ethraw.c)
+#define LITEXCNC_ETH_NAME    "litexcnc_ethraw"
+#define LITEXCNC_ETH_DRIVER  "ethraw"
+#else
 #define LITEXCNC_ETH_NAME    "litexcnc_eth"
+#define LITEXCNC_ETH_DRIVER  "eth"
+#endif
 #define LITEXCNC_ETH_VERSION "1.0.0"
 #define MAX_ETH_BOARDS 4
 
+// Transfer modes for the cyclic data (connection option `transfer`)
+// - separate: the write and the read request are sent as two packets
+#define LITEXCNC_ETH_TRANSFER_SEPARATE 0
+// - combined: a single packet contains both the write and the read request
+#define LITEXCNC_ETH_TRANSFER_COMBINED 1
+
+// Timestamping of the packets (connection option `timestamps`)
+#define LITEXCNC_ETH_TIMESTAMPS_NONE     0
+#define LITEXCNC_ETH_TIMESTAMPS_SOFTWARE 1
+#define LITEXCNC_ETH_TIMESTAMPS_HARDWARE 2
+
+// Retry of lost read requests within the cycle (param `retry_fraction`)
+// - default time to wait before the read request is sent again, as fraction of the period
+#define LITEXCNC_ETH_DEFAULT_RETRY_FRACTION 0.25
+
+// Fragmentation of the cyclic data, when it does not fit in a single record
+// - maximum number of fragments to read (limited by the bitmask of received fragments)
+#define LITEXCNC_ETH_MAX_FRAGMENTS 32
+// - distance between the read requests of the fragments in the request buffer
+#define LITEXCNC_ETH_READ_REQUEST_STRIDE (16 + 4 * EB_MAX_RECORD_WORDS)
+
+// Statistics of the round-trip time (RTT) of the read requests
+// - number of buckets of the histogram on HAL, the last bucket contains all larger RTTs
+#define LITEXCNC_ETH_HISTOGRAM_BUCKETS 16
+// - default width of a bucket of the histogram (param `rtt_bucket_ns`)
+#define LITEXCNC_ETH_DEFAULT_BUCKET_NS 25000
+// - number of samples in the sliding window for the 99th percentile
+#define LITEXCNC_ETH_WINDOW_SIZE 1000
+// - resolution and number of buckets of the histogram of the sliding window
+#define LITEXCNC_ETH_WINDOW_RESOLUTION_NS 5000
+#define LITEXCNC_ETH_WINDOW_BUCKETS 256
+
+// Redundant links to the same board (connection string `<address>|<address>`)
+#define LITEXCNC_ETH_MAX_LINKS 2
+
+#include <time.h>
+
 #include "etherbone.h"
 #include <litexcnc.h>
 
+// One of the redundant links to a board. Each packet is sent on all links, the first
+// response which arrives is used.
+typedef struct {
+    struct {
+        struct {
+            hal_u32_t *packets_sent;       // Number of packets sent on this link
+            hal_u32_t *packets_received;   // Number of responses received on this link
+            hal_u32_t *packets_lost;       // Number of requests of which the response did not arrive on this link
+            hal_u32_t *responses_first;    // Number of responses which arrived first on this link
+            hal_u32_t *rtt_ns;             // Round-trip time of the last response on this link
+        } pin;
+    } hal;
+
+    struct eb_connection *connection;
+    uint32_t received_current;   // Fragments of the current request received on this link
+    uint32_t received_previous;  // Fragments of the previous request received on this link
+} litexcnc_eth_link_t;
+
 typedef struct {
 
     struct {
+        struct {
+            hal_u32_t *packets_late;       // Number of responses which arrived after their cycle
+            hal_u32_t *packets_dropped;    // Number of responses which did not arrive in time
+            hal_u32_t *packets_sent;       // Number of packets sent in the cyclic functions
+            hal_u32_t *packets_received;   // Number of responses received in the cyclic functions
+            hal_u32_t *packets_short;      // Number of responses with an unexpected length
+            hal_u32_t *packets_malformed;  // Number of responses which are not Etherbone responses
+            hal_u32_t *send_errors;        // Number of packets which could not be sent
+            hal_u32_t *read_retries;       // Number of read requests which have been sent again
+            hal_u32_t *rtt_ns;             // Round-trip time of the last read request
+            hal_u32_t *rtt_min_ns;         // Minimum round-trip time since the last reset
+            hal_u32_t *rtt_max_ns;         // Maximum round-trip time since the last reset
+            hal_u32_t *rtt_mean_ns;        // Mean round-trip time since the last reset
+            hal_u32_t *rtt_p99_ns;         // 99th percentile of the round-trip time in the window
+            hal_u32_t *rtt_histogram[LITEXCNC_ETH_HISTOGRAM_BUCKETS];
+            hal_bit_t *stats_reset;        // Resets the statistics while true
+            hal_u32_t *wire_rtt_ns;        // Round-trip time between the timestamps of the packets
+            hal_u32_t *one_way_ns;         // Estimated time for a packet to reach the FPGA
+            hal_u32_t *rx_latency_ns;      // Time between receiving the response and processing it
+            hal_float_t *write_phase;      // Moment the write arrives, in periods after the data was sampled
+            hal_bit_t *hardware_timestamps;  // The timestamps are made by the network card
+        } pin;
         struct {
             hal_bit_t debug;  // Indicates the communication is in debug mode
+            hal_u32_t packet_gap_ns;       // Minimum time between two packets
+            hal_u32_t packet_wait_ns;      // Time waited before sending the last packet
+            hal_u32_t packet_wait_max_ns;  // Maximum time waited before sending a packet
+            hal_u32_t spin_time_ns;        // Time spent spinning for the last response
+            hal_u32_t spin_time_max_ns;    // Maximum time spent spinning for a response
+            hal_u32_t rtt_bucket_ns;       // Width of a bucket of the histogram
+            hal_float_t retry_fraction;    // Time to wait before the read is retried, as fraction of the period
         } param;
     } hal;
 
-    // Connection by etherbone, required for sending/receiving data.
+    // Connection by etherbone, required for sending/receiving data. With redundant links
+    // this is the connection of the first link, which is also used for the initialization.
     struct eb_connection* connection;
+    litexcnc_eth_link_t links[LITEXCNC_ETH_MAX_LINKS];
+    size_t link_count;
+    bool links_started;     // The statistics of the links have been through a full cycle
+    int transfer_mode;      // See LITEXCNC_ETH_TRANSFER_*
+    bool pipelined;         // The read request for the next cycle is sent directly after the write
+    bool response_pending;  // A read request has been sent, the response is not collected yet
+    bool busy_poll;         // Spin for the response instead of waiting (connection option `poll`)
+    bool burst;             // Request the data with a burst read (connection option `burst`)
+    bool io_uring;          // The sockets are driven with an io_uring (connection option `io`)
+    uint32_t sequence;      // Sequence number of the last read request
+    struct timespec request_time;  // Moment the last read request has been sent
+    struct timespec previous_request_time;  // Moment the read request before that has been sent
+
+    // Timestamps of the packets, taken by the kernel or the network card (connection
+    // option `timestamps`). Only available when timestamping is enabled.
+    int timestamping;       // See LITEXCNC_ETH_TIMESTAMPS_*
+    struct {
+        uint32_t request_id;             // Number of the packet with the (first) read request
+        uint32_t write_id;               // Number of the last packet with data to write
+        struct timespec request_software;
+        struct timespec request_hardware;
+        struct timespec response_software;
+        struct timespec response_hardware;
+        struct timespec write_software;
+        int64_t previous_sample_ns;      // Moment the data of the previous cycle was sampled
+    } timestamps;
+
+    // Statistics of the round-trip time. These are only modified by the real-time thread,
+    // the HAL pins are updated with single writes, so no locking is required.
+    struct {
+        uint64_t rtt_sum;
+        uint32_t rtt_count;
+        uint8_t window[LITEXCNC_ETH_WINDOW_SIZE];  // Bucket of each sample in the window
+        uint16_t window_buckets[LITEXCNC_ETH_WINDOW_BUCKETS];
+        size_t window_index;
+        size_t window_filled;
+    } stats;
+
+    // Fragments of the cyclic data, each fragment is sent as a separate packet
+    size_t read_words;
+    size_t read_fragments;
+    size_t write_words;
+    size_t write_fragments;
+    uint8_t *write_fragment_headers;  // Etherbone header (16 bytes) for each fragment
+    uint8_t *write_run_headers;       // Etherbone header (16 bytes) for each run of a sparse write
+    uint8_t *fragment_buffer;         // Buffer for receiving a fragment of the read data
 
     // Buffer for requesting a read from the device
     uint8_t *read_request_buffer;
@@ -0,0 +1,32 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+
+// The raw Ethernet driver is the same as the Etherbone driver, except for the
+// connection which bypasses the network stack of the kernel. Each driver is a
+// separate library, so the driver is compiled once more with the raw transport
+#define LITEXCNC_ETH_RAW
+#include "litexcnc_eth.c"
+
+
+int register_ethraw_driver(void) {
+    registration = (litexcnc_driver_registration_t *)hal_malloc(sizeof(litexcnc_driver_registration_t));
+    rtapi_snprintf(registration->name, sizeof(registration->name), LITEXCNC_ETH_DRIVER);
+    registration->initialize_driver = *initialize_driver;
+    return litexcnc_register_driver(registration);
+}
+EXPORT_SYMBOL_GPL(register_ethraw_driver);
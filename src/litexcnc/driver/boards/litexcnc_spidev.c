@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <time.h>
 #include <linux/spi/spidev.h>
 
 #include <rtapi_slab.h>
@@ -53,10 +54,14 @@ static litexcnc_driver_registration_t *registration;
 /*
  * Parameters for SPI connection (prevent magic numbers in the code)
  **/
-static uint32_t speed = 1800000;
 static uint16_t delay;
 static uint8_t bits = 8;
 
+/*
+ * Lookup table for the CRC of the commands, filled when a board requests the CRC
+ **/
+static uint16_t crc_table[256];
+
 /*******************************************************************************
  * Registers this SPI-driver within LitexCNC driver. Gets called from litexcnc.c
  * when a user connects to a card using the connection-string `spi:<file-descriptor>`.
@@ -72,6 +77,366 @@ int register_spidev_driver(void) {
 EXPORT_SYMBOL_GPL(register_spidev_driver);
 
 
+/*******************************************************************************
+ * Returns the number of bytes transferred for N bytes of data. The bridge on the
+ * FPGA handles at most LITEXCNC_SPI_MAX_WORDS words per command, each command adds
+ * LITEXCNC_SPI_COMMAND_OVERHEAD bytes to the data.
+ *
+ * @param N       The number of bytes of data to read or write.
+ ******************************************************************************/
+static size_t litexcnc_spi_message_size(size_t N) {
+    size_t commands = ((N >> 2) + LITEXCNC_SPI_MAX_WORDS - 1) / LITEXCNC_SPI_MAX_WORDS;
+    return N + commands * LITEXCNC_SPI_COMMAND_OVERHEAD;
+}
+
+
+/*******************************************************************************
+ * Fills the lookup table for the CRC-16/CCITT of the commands.
+ ******************************************************************************/
+static void litexcnc_spi_crc_init(void) {
+    for (size_t i=0; i<256; i++) {
+        uint16_t crc = i << 8;
+        for (size_t bit=0; bit<8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ LITEXCNC_SPI_CRC_POLYNOMIAL : (crc << 1);
+        }
+        crc_table[i] = crc;
+    }
+}
+
+
+/*******************************************************************************
+ * Returns the CRC of a command, calculated over the header and the data in the
+ * order in which they are transferred. The CRC is returned big-endian, as it is
+ * transferred after the data.
+ *
+ * @param header  The header of the command (LITEXCNC_SPI_HEADER_SIZE bytes).
+ * @param data    The data written or read by the command.
+ * @param size    The size of the data.
+ ******************************************************************************/
+static uint16_t litexcnc_spi_command_crc(const uint8_t *header, const uint8_t *data, size_t size) {
+    uint16_t crc = LITEXCNC_SPI_CRC_INIT;
+    for (size_t i=0; i<LITEXCNC_SPI_HEADER_SIZE; i++) {
+        crc = (crc << 8) ^ crc_table[(crc >> 8) ^ header[i]];
+    }
+    for (size_t i=0; i<size; i++) {
+        crc = (crc << 8) ^ crc_table[(crc >> 8) ^ data[i]];
+    }
+    return htobe16(crc);
+}
+
+
+/*******************************************************************************
+ * Makes sure the board can hold a message of the given size. The commands and
+ * transfers are sized for the cyclic data when the board is registered, so memory
+ * is only allocated during initialisation. The commands, which hold the headers
+ * and responses of the message, are aligned to a cache line.
+ *
+ * @param board   The board to reserve the message for.
+ * @param size    The size of the message (see litexcnc_spi_message_size).
+ ******************************************************************************/
+static int litexcnc_spi_reserve(litexcnc_spi_t *board, size_t size) {
+    // Each command contains at least a single word
+    size_t max_commands = size / (LITEXCNC_SPI_COMMAND_OVERHEAD + 4) + 1;
+    if (max_commands <= board->max_commands) {
+        return 0;
+    }
+
+    size_t max_transfers = LITEXCNC_SPI_TRANSFERS_PER_COMMAND * max_commands;
+    uint8_t *commands_memory = rtapi_kmalloc(max_commands * sizeof(litexcnc_spi_command_t) + LITEXCNC_SPI_CACHE_LINE - 1, RTAPI_GFP_KERNEL);
+    struct spi_ioc_transfer *transfers = rtapi_kmalloc(max_transfers * sizeof(struct spi_ioc_transfer), RTAPI_GFP_KERNEL);
+    if ((commands_memory == NULL) || (transfers == NULL)) {
+        LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+        if (commands_memory != NULL) rtapi_kfree(commands_memory);
+        if (transfers != NULL) rtapi_kfree(transfers);
+        return -ENOMEM;
+    }
+
+    // Replace the previous message
+    if (board->max_commands > 0) {
+        rtapi_kfree(board->commands_memory);
+        rtapi_kfree(board->transfers);
+    }
+    board->commands_memory = commands_memory;
+    board->commands = (litexcnc_spi_command_t *) (((uintptr_t) commands_memory + LITEXCNC_SPI_CACHE_LINE - 1) & ~((uintptr_t) LITEXCNC_SPI_CACHE_LINE - 1));
+    board->max_commands = max_commands;
+    board->transfers = transfers;
+    board->max_transfers = max_transfers;
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Adds a transfer to the message of the board.
+ *
+ * @param board   The board to send the message to.
+ * @param tx      The data to transmit, or NULL to transmit zeros.
+ * @param rx      The buffer for the received data, or NULL to discard it.
+ * @param len     The length of the transfer.
+ * @param last    Whether this is the last transfer of a command, after which the
+ *                chip select is released.
+ ******************************************************************************/
+static void litexcnc_spi_add_transfer(litexcnc_spi_t *board, uint8_t *tx, uint8_t *rx, size_t len, bool last) {
+    struct spi_ioc_transfer *transfer = &board->transfers[board->transfer_count++];
+    memset(transfer, 0, sizeof(struct spi_ioc_transfer));
+    transfer->tx_buf = (unsigned long) tx;
+    transfer->rx_buf = (unsigned long) rx;
+    transfer->len = len;
+    transfer->delay_usecs = delay;
+    transfer->speed_hz = board->speed;
+    transfer->bits_per_word = bits;
+    transfer->cs_change = last;
+}
+
+
+/*******************************************************************************
+ * Adds the commands to read or write N bytes of data, starting at the given
+ * address, to the message. Data larger than LITEXCNC_SPI_MAX_WORDS words is split
+ * over multiple commands. The chip select is released between the commands to
+ * end the command on the FPGA.
+ *
+ * The data is transferred in place; the header and the response of each command
+ * are separate transfers of the same message. When the space in front of the
+ * data is reserved (LITEXCNC_SPI_BUFFER_HEADER_SIZE), the header of a write is
+ * stored in that space and transferred together with the data. When the board
+ * uses the CRC, it is sent after the data of a write and received after the
+ * data of a read.
+ *
+ * @param board    The board to send the message to.
+ * @param command  The command, LITEXCNC_SPI_COMMAND_READ or LITEXCNC_SPI_COMMAND_WRITE.
+ * @param address  The address to start the read or write from.
+ * @param data     The data to write, or the array where the read data is stored in.
+ * @param N        The number of the bytes to read or write (multiple of 4).
+ * @param reserved Whether the space in front of the data is reserved for the header.
+ * @return 0 on success, -1 when the message does not fit (the message is then 
+ *         discarded).
+ ******************************************************************************/
+static int litexcnc_spi_queue(litexcnc_spi_t *board, uint8_t command, size_t address, uint8_t *data, size_t N, bool reserved) {
+    // A new message overwrites the response of a previous combined transfer
+    if (board->command_count == 0) {
+        board->response_pending = false;
+    }
+    for (size_t offset=0; offset<N; offset+=4*LITEXCNC_SPI_MAX_WORDS) {
+        size_t size = MIN(N - offset, 4 * LITEXCNC_SPI_MAX_WORDS);
+        if ((board->command_count == board->max_commands) || 
+            (board->transfer_count + LITEXCNC_SPI_TRANSFERS_PER_COMMAND > board->max_transfers)) {
+            board->command_count = 0;
+            board->transfer_count = 0;
+            return -1;
+        }
+
+        // Create the command
+        litexcnc_spi_command_t *cmd = &board->commands[board->command_count++];
+        cmd->read = (command == LITEXCNC_SPI_COMMAND_READ);
+        cmd->data = data + offset;
+        cmd->size = size;
+        // - the header is stored in front of the data when that space is reserved,
+        //   which is only the case for the first command
+        uint8_t *header = cmd->header;
+        if (reserved && (offset == 0) && !cmd->read) {
+            header = cmd->data - LITEXCNC_SPI_HEADER_SIZE;
+        }
+        header[0] = command + (size >> 2);
+        uint32_t address_be = htobe32((address + offset) | (board->crc ? LITEXCNC_SPI_ADDRESS_CRC : 0));
+        memcpy(&header[1], &address_be, 4);
+
+        // Create the transfers
+        if (cmd->read) {
+            // The bridge responds while the padding of the header is transferred, the data
+            // directly follows the response.
+            memset(&header[LITEXCNC_SPI_HEADER_SIZE], 0, board->read_overhead - LITEXCNC_SPI_HEADER_SIZE);
+            litexcnc_spi_add_transfer(board, header, cmd->response, board->read_overhead, false);
+            litexcnc_spi_add_transfer(board, NULL, cmd->data, size, !board->crc);
+            if (board->crc) {
+                litexcnc_spi_add_transfer(board, NULL, cmd->crc, LITEXCNC_SPI_CRC_SIZE, true);
+            }
+        } else {
+            // The bridge responds after the data has been written
+            if (header == cmd->header) {
+                litexcnc_spi_add_transfer(board, header, NULL, LITEXCNC_SPI_HEADER_SIZE, false);
+                litexcnc_spi_add_transfer(board, cmd->data, NULL, size, false);
+            } else {
+                litexcnc_spi_add_transfer(board, header, NULL, LITEXCNC_SPI_HEADER_SIZE + size, false);
+            }
+            if (board->crc) {
+                uint16_t crc = litexcnc_spi_command_crc(header, cmd->data, size);
+                memcpy(cmd->crc, &crc, LITEXCNC_SPI_CRC_SIZE);
+                litexcnc_spi_add_transfer(board, cmd->crc, NULL, LITEXCNC_SPI_CRC_SIZE, false);
+            }
+            litexcnc_spi_add_transfer(board, NULL, cmd->response, board->write_response[size >> 2], true);
+        }
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Transfers the queued commands with a single ioctl. The responses of the
+ * commands remain with the board until the next message is queued, and are
+ * checked with litexcnc_spi_check.
+ *
+ * @param this    Pointer to the FPGA to transfer the data with.
+ * @return The number of transferred commands on success, -1 on failure.
+ ******************************************************************************/
+static int litexcnc_spi_transfer(litexcnc_fpga_t *this) {
+    litexcnc_spi_t *board = this->private;
+    size_t count = board->command_count;
+    size_t transfers = board->transfer_count;
+    board->command_count = 0;
+    board->transfer_count = 0;
+    if (count == 0) {
+        return 0;
+    }
+
+    // The chip select should be released after the last command, for the last transfer
+    // `cs_change` would keep it asserted until the next message
+    board->transfers[transfers - 1].cs_change = 0;
+    int ret = ioctl(board->connection, SPI_IOC_MESSAGE(transfers), board->transfers);
+	if (ret < 1) {
+        LITEXCNC_ERR("Could not transfer data with SPI device\n", this->name);
+		return -1;
+    }
+    return count;
+}
+
+
+/*******************************************************************************
+ * Checks the responses of the given commands of the last transfer. The response
+ * of a read is expected directly before the data. When the latency of the bridge
+ * is not known, the response is searched for and the data is moved to its 
+ * destination when the bridge has responded earlier than expected. When the
+ * board uses the CRC, the CRC of the data read is verified.
+ *
+ * @param this    Pointer to the FPGA the data has been transferred with.
+ * @param first   The first command to check.
+ * @param count   The number of commands to check.
+ * @return 0 on success, -1 when a command has failed.
+ ******************************************************************************/
+static int litexcnc_spi_check(litexcnc_fpga_t *this, size_t first, size_t count) {
+    litexcnc_spi_t *board = this->private;
+
+    // Check whether each command was successfull, indicated by the byte 0x01. For reads
+    // the data directly follows this byte.
+    for (size_t i=first; i<first+count; i++) {
+        litexcnc_spi_command_t *cmd = &board->commands[i];
+        size_t limit = cmd->read ? board->read_overhead : board->write_response[cmd->size >> 2];
+        size_t j = 0;
+        if (cmd->read && (board->response_latency >= 0)) {
+            j = (cmd->response[limit - 1] == 0x01) ? limit - 1 : limit;
+        } else {
+            while ((j < limit) && (cmd->response[j] != 0x01)) {
+                j++;
+            }
+        }
+        if (j == limit) {
+            if (board->hal.pin.response_errors != NULL) {
+                (*board->hal.pin.response_errors)++;
+            }
+            if (cmd->read) {
+                LITEXCNC_ERR("Read from SPI device was unsuccessful.\n", this->name);
+            } else {
+                LITEXCNC_ERR("Write to SPI device was unsuccessful.\n", this->name);
+            }
+            return -1;
+        }
+        if (cmd->read && (j < limit - 1)) {
+            // The first bytes of the data have been received with the response
+            size_t early = MIN(limit - 1 - j, cmd->size);
+            memmove(cmd->data + early, cmd->data, cmd->size - early);
+            memcpy(cmd->data, &cmd->response[j+1], early);
+        }
+        if (cmd->read && board->crc) {
+            uint16_t crc = litexcnc_spi_command_crc(cmd->header, cmd->data, cmd->size);
+            if (memcmp(&crc, cmd->crc, LITEXCNC_SPI_CRC_SIZE) != 0) {
+                if (board->hal.pin.crc_errors != NULL) {
+                    (*board->hal.pin.crc_errors)++;
+                }
+                LITEXCNC_ERR("CRC of the data read from SPI device is incorrect.\n", this->name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Measures the number of bytes between the header and the response of a read, by
+ * reading the magic of the FPGA with additional padding. The latency is constant
+ * for a given speed of the SPI bus, when the measurements are not consistent the
+ * response is searched for in each read.
+ *
+ * @param board   The board to measure the latency of.
+ * @return The latency in bytes, or -1 when the latency could not be determined.
+ ******************************************************************************/
+static int litexcnc_spi_measure_latency(litexcnc_spi_t *board) {
+    uint8_t tx[LITEXCNC_SPI_MAX_READ_OVERHEAD + 4] = {LITEXCNC_SPI_COMMAND_READ + 1, 0, 0, 0, 0};
+    uint8_t rx[LITEXCNC_SPI_MAX_READ_OVERHEAD + 4];
+    uint32_t magic = htobe32(LITEXCNC_SPI_MAGIC);
+    int latency = -1;
+
+    for (size_t i=0; i<LITEXCNC_SPI_LATENCY_MEASUREMENTS; i++) {
+        litexcnc_spi_add_transfer(board, tx, rx, sizeof(tx), false);
+        board->transfer_count = 0;
+        if (ioctl(board->connection, SPI_IOC_MESSAGE(1), board->transfers) < 1) {
+            return -1;
+        }
+        size_t j = LITEXCNC_SPI_HEADER_SIZE;
+        while ((j < LITEXCNC_SPI_MAX_READ_OVERHEAD) && (rx[j] != 0x01)) {
+            j++;
+        }
+        if ((j == LITEXCNC_SPI_MAX_READ_OVERHEAD) || (memcmp(&rx[j+1], &magic, 4) != 0)) {
+            return -1;
+        }
+        if ((latency >= 0) && (latency != (int) (j - LITEXCNC_SPI_HEADER_SIZE))) {
+            LITEXCNC_WARN_NO_DEVICE("Latency of the SPI bridge is not constant, consider lowering the speed.\n");
+            return -1;
+        }
+        latency = j - LITEXCNC_SPI_HEADER_SIZE;
+    }
+    return latency;
+}
+
+
+/*******************************************************************************
+ * Verifies the FPGA supports the CRC, by reading the magic with a CRC. Firmware
+ * without support for the CRC does not send the CRC after the data.
+ *
+ * @param board   The board to verify, of which the latency has been measured.
+ * @return 0 when the CRC is supported, -1 otherwise.
+ ******************************************************************************/
+static int litexcnc_spi_verify_crc(litexcnc_spi_t *board) {
+    uint8_t tx[LITEXCNC_SPI_MAX_READ_OVERHEAD + 4 + LITEXCNC_SPI_CRC_SIZE] = {LITEXCNC_SPI_COMMAND_READ + 1, LITEXCNC_SPI_ADDRESS_CRC >> 24, 0, 0, 0};
+    uint8_t rx[LITEXCNC_SPI_MAX_READ_OVERHEAD + 4 + LITEXCNC_SPI_CRC_SIZE];
+
+    litexcnc_spi_add_transfer(board, tx, rx, board->read_overhead + 4 + LITEXCNC_SPI_CRC_SIZE, false);
+    board->transfer_count = 0;
+    if (ioctl(board->connection, SPI_IOC_MESSAGE(1), board->transfers) < 1) {
+        return -1;
+    }
+    uint16_t crc = litexcnc_spi_command_crc(tx, &rx[board->read_overhead], 4);
+    if ((rx[board->read_overhead - 1] != 0x01) || (memcmp(&crc, &rx[board->read_overhead + 4], LITEXCNC_SPI_CRC_SIZE) != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/*******************************************************************************
+ * Transfers the queued commands with a single ioctl and checks the response of
+ * each command.
+ *
+ * @param this    Pointer to the FPGA to transfer the data with.
+ * @return 0 on success, -1 on failure.
+ ******************************************************************************/
+static int litexcnc_spi_submit(litexcnc_fpga_t *this) {
+    int count = litexcnc_spi_transfer(this);
+    if (count < 0) {
+        return -1;
+    }
+    return litexcnc_spi_check(this, 0, count);
+}
+
+
 /*******************************************************************************
  * This function reads N bytes of data from the FPGA starting from the given
  * address. This function is used to read one-off data from the FPGA, such as
@@ -85,65 +450,77 @@ EXPORT_SYMBOL_GPL(register_spidev_driver);
  ******************************************************************************/
 static int litexcnc_spi_read_n_bytes(litexcnc_fpga_t *this, size_t address, uint8_t *data, size_t N) {
     litexcnc_spi_t *board = this->private;
-    
-    // Create the required buffers
-    static uint8_t tx_buf[5+2+256];
-    memset((void*) tx_buf, 5, 2+N);
-    static uint8_t rx_buf[5+2+256];
-    memset((void*) rx_buf, 0, 5+2+N);
-
-     // Write data to package
-    // - command and size
-    size_t words = N >> 2;
-    tx_buf[0] = 0x40 + (words & 0x1F);
-    // - address
-    uint32_t address_be = htobe32(address);
-    memcpy(&tx_buf[1], &address_be, 4);
-    
-    // Create the request and send the data 
-    struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)&tx_buf,
-		.rx_buf = (unsigned long)&rx_buf,
-		.len = 5 + N + 2,
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
-    int ret = ioctl(board->connection, SPI_IOC_MESSAGE(1), &tr);
-	if (ret < 1) {
-        LITEXCNC_ERR("Could not read from SPI device\n", this->name);
-		return -1;
-    }
-    
-    // Check whether write was successfull
-    for(size_t i = 0; i < (5 + 2); i++) {
-        if(rx_buf[i] == 0x01) {
-            // Copy the results to the output
-            memcpy(data, &rx_buf[i+1], N);
-            // Indicate success
-            return 0;
-        }
+    if ((litexcnc_spi_reserve(board, litexcnc_spi_message_size(N)) < 0) ||
+        (litexcnc_spi_queue(board, LITEXCNC_SPI_COMMAND_READ, address, data, N, false) < 0)) {
+        return -1;
     }
+    return litexcnc_spi_submit(this);
+}
 
-    // Writing has failed
-    LITEXCNC_ERR("Read from SPI device was unsuccessful.\n", this->name);
-    return -1;
 
+/*******************************************************************************
+ * Determines the number of bytes in which the bridge responds to a write of each
+ * number of words. Without the CRC the words are written while they are received
+ * and the bridge responds directly. With the CRC the words are written after the
+ * CRC has been received, which depends on the speed of the SPI bus relative to
+ * the clock of the FPGA. The clock is read from the header of the FPGA.
+ *
+ * @param board   The board, of which the latency has been measured.
+ * @param speed   The speed of the SPI bus in Hz.
+ * @return 0 on success, -1 when the clock could not be read or the speed of the
+ *         SPI bus is too high for the clock of the FPGA.
+ ******************************************************************************/
+static int litexcnc_spi_size_write_response(litexcnc_spi_t *board, uint32_t speed) {
+    uint32_t clock_frequency;
+
+    for (size_t words=0; words<=LITEXCNC_SPI_MAX_WORDS; words++) {
+        board->write_response[words] = LITEXCNC_SPI_RESPONSE_SIZE;
+    }
+    if (!board->crc) {
+        return 0;
+    }
+    if (litexcnc_spi_read_n_bytes(&board->fpga, offsetof(litexcnc_header_data_read_t, clock_frequency), (uint8_t *) &clock_frequency, 4) < 0) {
+        return -1;
+    }
+    clock_frequency = be32toh(clock_frequency);
+    if ((uint64_t) 4 * speed > clock_frequency) {
+        LITEXCNC_ERR_NO_DEVICE("The speed of the SPI bus (%u Hz) exceeds 1/4 of the clock of the FPGA (%u Hz).\n", speed, clock_frequency);
+        return -1;
+    }
+    for (size_t words=1; words<=LITEXCNC_SPI_MAX_WORDS; words++) {
+        uint64_t bits = (uint64_t) words * LITEXCNC_SPI_WRITE_CYCLES_PER_WORD * speed;
+        board->write_response[words] = LITEXCNC_SPI_RESPONSE_SIZE + (bits + 8ULL * clock_frequency - 1) / (8ULL * clock_frequency);
+    }
+    return 0;
 }
 
 
 /*******************************************************************************
- * This function reads the status registers from the FPGA. IT is relyaed to the
- * standard function litexcnc_spi_read_n_bytes.
+ * This function reads the status registers from the FPGA directly into the read
+ * buffer. In combined transfer mode the data has already been read together with
+ * the write of the previous cycle, and only the response of that transfer is 
+ * checked.
  *
  * @param this    Pointer to the FPGA to read the data from.
  ******************************************************************************/
 static int litexcnc_spi_read(litexcnc_fpga_t *this) {
-    return litexcnc_spi_read_n_bytes(
-        this, 
-        this->read_base_address, 
-        this->read_buffer, 
-        this->read_buffer_size);
+    litexcnc_spi_t *board = this->private;
+    this->read_timestamp_ns = 0;
+    if (board->response_pending) {
+        board->response_pending = false;
+        this->read_timestamp_ns = board->response_time_ns;
+        return litexcnc_spi_check(this, board->response_first, board->response_count);
+    }
+    if (litexcnc_spi_queue(
+            board,
+            LITEXCNC_SPI_COMMAND_READ,
+            this->read_base_address,
+            this->read_buffer + this->read_header_size,
+            this->read_buffer_size - this->read_header_size,
+            true) < 0) {
+        return -1;
+    }
+    return litexcnc_spi_submit(this);
 }
 
 
@@ -160,62 +537,87 @@ static int litexcnc_spi_read(litexcnc_fpga_t *this) {
  ******************************************************************************/
 static int litexcnc_spi_write_n_bytes(litexcnc_fpga_t *this, size_t address, uint8_t *data, size_t N) {
     litexcnc_spi_t *board = this->private;
-    
-    // Create the required buffers
-    static uint8_t tx_buf[5+2+256];
-    static uint8_t rx_buf[5+2+256];
-    memset((void*) rx_buf, 0, 5+2+N);
-
-     // Write data to package
-    // - command and size
-    size_t words = N >> 2;
-    tx_buf[0] = 0x80 + (words & 0x1F);
-    // - address
-    uint32_t address_be = htobe32(address);
-    memcpy(&tx_buf[1], &address_be, 4);
-    // - data
-    memcpy(&tx_buf[5], data, N);
-
-    // Create the request and send the data 
-    struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long)&tx_buf,
-		.rx_buf = (unsigned long)&rx_buf,
-		.len = 5 + N + 2,
-		.delay_usecs = delay,
-		.speed_hz = speed,
-		.bits_per_word = bits,
-	};
-    int ret = ioctl(board->connection, SPI_IOC_MESSAGE(1), &tr);
-	if (ret < 1) {
-        LITEXCNC_ERR("Could not write to SPI device\n", this->name);
-		return -1;
+    if ((litexcnc_spi_reserve(board, litexcnc_spi_message_size(N)) < 0) ||
+        (litexcnc_spi_queue(board, LITEXCNC_SPI_COMMAND_WRITE, address, data, N, false) < 0)) {
+        return -1;
     }
+    return litexcnc_spi_submit(this);
+}
 
-    // Check whether write was successfull
-    for(size_t i = 0; i < (5 + N + 2); i++) {
-        if(rx_buf[i] == 0x01) {
-            // Indicate success
-            return 0;
-        }
+
+/*******************************************************************************
+ * Transfers the queued write commands. In combined transfer mode the commands to
+ * read the status registers are added to the same message, so a cycle requires a
+ * single ioctl. The data is received directly in the read buffer, its response 
+ * is checked in the next cycle.
+ *
+ * @param this    Pointer to the FPGA to write the data to.
+ ******************************************************************************/
+static int litexcnc_spi_finish_write(litexcnc_fpga_t *this) {
+    litexcnc_spi_t *board = this->private;
+    if (board->transfer_mode != LITEXCNC_SPI_TRANSFER_COMBINED) {
+        return litexcnc_spi_submit(this);
     }
 
-    // Writing has failed
-    LITEXCNC_ERR("Write to SPI device was unsuccessful.\n", this->name);
-    return -1;
+    size_t first = board->command_count;
+    if (litexcnc_spi_queue(
+            board,
+            LITEXCNC_SPI_COMMAND_READ,
+            this->read_base_address,
+            this->read_buffer + this->read_header_size,
+            this->read_buffer_size - this->read_header_size,
+            true) < 0) {
+        return -1;
+    }
+    int count = litexcnc_spi_transfer(this);
+    if (count < 0) {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    board->response_time_ns = (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+    board->response_first = first;
+    board->response_count = count - first;
+    board->response_pending = true;
+    return litexcnc_spi_check(this, 0, first);
 }
 
 
 /*******************************************************************************
- * This function writes the status registers to the FPGA
+ * This function writes the status registers to the FPGA. When only a part of the
+ * data has changed since the previous write, only the changed runs are written,
+ * each with its own write command. The runs are only written when this transfers
+ * less bytes than writing the complete buffer. All commands are transferred in a
+ * single message, directly from the write buffer.
  *
  * @param this    Pointer to the FPGA to write the data to.
  ******************************************************************************/
 static int litexcnc_spi_write(litexcnc_fpga_t *this) {
-    return litexcnc_spi_write_n_bytes(
-        this, 
-        this->write_base_address, 
-        this->write_buffer, 
-        this->write_buffer_size);
+    litexcnc_spi_t *board = this->private;
+    size_t size = this->write_buffer_size - this->write_header_size;
+    size_t bytes = 0;
+    for (size_t i=0; i<this->write_run_count; i++) {
+        bytes += litexcnc_spi_message_size(this->write_runs[i].size);
+    }
+    if ((this->write_run_count == 0) || (bytes >= litexcnc_spi_message_size(size))) {
+        if (litexcnc_spi_queue(board, LITEXCNC_SPI_COMMAND_WRITE, this->write_base_address, this->write_buffer + this->write_header_size, size, true) < 0) {
+            return -1;
+        }
+        return litexcnc_spi_finish_write(this);
+    }
+    for (size_t i=0; i<this->write_run_count; i++) {
+        // Only the run at the start of the buffer has its header space reserved
+        if (litexcnc_spi_queue(
+                board,
+                LITEXCNC_SPI_COMMAND_WRITE,
+                this->write_base_address + this->write_runs[i].offset,
+                this->write_buffer + this->write_header_size + this->write_runs[i].offset,
+                this->write_runs[i].size,
+                this->write_runs[i].offset == 0) < 0) {
+            return -1;
+        }
+    }
+    return litexcnc_spi_finish_write(this);
 }
 
 
@@ -231,14 +633,71 @@ static int litexcnc_spi_write(litexcnc_fpga_t *this) {
  ******************************************************************************/
 static int initialize_driver(char *connection_string, int comp_id) {
     size_t ret;
+    char value[16];
     boards[boards_count] = (litexcnc_spi_t *)hal_malloc(sizeof(litexcnc_spi_t));
+    boards[boards_count]->max_commands = 0;
+    boards[boards_count]->command_count = 0;
+    boards[boards_count]->max_transfers = 0;
+    boards[boards_count]->transfer_count = 0;
+    boards[boards_count]->response_pending = false;
+    boards[boards_count]->response_latency = -1;
+    boards[boards_count]->read_overhead = LITEXCNC_SPI_COMMAND_OVERHEAD;
+    // Split the options (i.e. `?transfer=combined`) from the connection string
+    char *options = litexcnc_split_options(connection_string);
+    boards[boards_count]->transfer_mode = LITEXCNC_SPI_TRANSFER_SEPARATE;
+    if (litexcnc_get_option(options, "transfer", value, sizeof(value))) {
+        if (strcmp(value, "combined") == 0) {
+            boards[boards_count]->transfer_mode = LITEXCNC_SPI_TRANSFER_COMBINED;
+            // The data read is collected when the previous cycle is written
+            boards[boards_count]->fpga.read_lag = 1;
+        } else if (strcmp(value, "separate") != 0) {
+            LITEXCNC_ERR_NO_DEVICE("Unknown transfer mode '%s'\n", value);
+            return -1;
+        }
+    }
+    boards[boards_count]->speed = LITEXCNC_SPIDEV_DEFAULT_SPEED;
+    if (litexcnc_get_option(options, "speed", value, sizeof(value))) {
+        boards[boards_count]->speed = atoi(value);
+    }
+    boards[boards_count]->crc = false;
+    if (litexcnc_get_option(options, "crc", value, sizeof(value))) {
+        // Requires the firmware to be built with `crc` enabled
+        boards[boards_count]->crc = (atoi(value) != 0);
+    }
     boards[boards_count]->connection = open(connection_string, O_RDWR);
     if (boards[boards_count]->connection < 0) {
         fprintf(stderr, "main: opening device file: %s: %s\n", connection_string, strerror(errno));
         return errno;
     }
+    // The speed of the transfers is limited by the maximum speed of the device
+    if (ioctl(boards[boards_count]->connection, SPI_IOC_WR_MAX_SPEED_HZ, &boards[boards_count]->speed) < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Could not set the speed of the SPI device to %u Hz\n", boards[boards_count]->speed);
+        return -1;
+    }
     // ret = connect_board(boards[boards_count], connection_string);
     // if (ret < 0) return ret;
+    // Determine the position of the response of the bridge, after which the data of each
+    // read is expected at a fixed position
+    ret = litexcnc_spi_reserve(boards[boards_count], litexcnc_spi_message_size(4));
+    if (ret != 0) {
+        return ret;
+    }
+    boards[boards_count]->response_latency = litexcnc_spi_measure_latency(boards[boards_count]);
+    if (boards[boards_count]->response_latency >= 0) {
+        boards[boards_count]->read_overhead = LITEXCNC_SPI_HEADER_SIZE + boards[boards_count]->response_latency + 1;
+    }
+    // The CRC follows the data at a fixed position, which requires a constant latency
+    if (boards[boards_count]->crc) {
+        litexcnc_spi_crc_init();
+        if (boards[boards_count]->response_latency < 0) {
+            LITEXCNC_ERR_NO_DEVICE("The CRC requires a constant latency of the SPI bridge, lower the speed.\n");
+            return -1;
+        }
+        if (litexcnc_spi_verify_crc(boards[boards_count]) < 0) {
+            LITEXCNC_ERR_NO_DEVICE("The firmware does not support the CRC, enable `crc` for the SPI connection.\n");
+            return -1;
+        }
+    }
     // Create an FPGA instance
     boards[boards_count]->fpga.comp_id           = comp_id;
     boards[boards_count]->fpga.read_n_bits       = litexcnc_spi_read_n_bytes;
@@ -246,20 +705,50 @@ static int initialize_driver(char *connection_string, int comp_id) {
     boards[boards_count]->fpga.read_header_size  = 0;
     boards[boards_count]->fpga.write_n_bits      = litexcnc_spi_write_n_bytes;
     boards[boards_count]->fpga.write             = litexcnc_spi_write;
-    boards[boards_count]->fpga.write_header_size = 0;
+    boards[boards_count]->fpga.write_header_size = LITEXCNC_SPI_BUFFER_HEADER_SIZE;
+    boards[boards_count]->fpga.sparse_write      = true;
     boards[boards_count]->fpga.private           = boards[boards_count];
+    // The response of a write with CRC is delayed by writing the buffered words
+    if (litexcnc_spi_size_write_response(boards[boards_count], boards[boards_count]->speed) < 0) {
+        return -1;
+    }
     // Register the board with the main function
     ret = litexcnc_register(&boards[boards_count]->fpga);
     if (ret != 0) {
         rtapi_print("board fails LitexCNC registration\n");
         return ret;
     }
+    // Size the message for the cyclic data and the configuration, so no memory is
+    // allocated once the board is running
+    ret = litexcnc_spi_reserve(
+        boards[boards_count],
+        MAX(litexcnc_spi_message_size(boards[boards_count]->fpga.read_buffer_size) + litexcnc_spi_message_size(boards[boards_count]->fpga.write_buffer_size),
+            litexcnc_spi_message_size(boards[boards_count]->fpga.config_buffer_size)));
+    if (ret != 0) {
+        return ret;
+    }
     // Create a pin to show debug messages
     ret = hal_param_bit_newf(HAL_RW, &(boards[boards_count]->hal.param.debug), comp_id, "%s.debug", boards[boards_count]->fpga.name);
     if (ret < 0) {
         LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.debug', aborting\n", boards[boards_count]->fpga.name);
         return ret;
     }
+    ret = hal_param_s32_newf(HAL_RO, &(boards[boards_count]->hal.param.response_latency), comp_id, "%s.response_latency", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s.response_latency', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
+    boards[boards_count]->hal.param.response_latency = boards[boards_count]->response_latency;
+    ret = hal_pin_u32_newf(HAL_OUT, &(boards[boards_count]->hal.pin.response_errors), comp_id, "%s.response_errors", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.response_errors', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
+    ret = hal_pin_u32_newf(HAL_OUT, &(boards[boards_count]->hal.pin.crc_errors), comp_id, "%s.crc_errors", boards[boards_count]->fpga.name);
+    if (ret < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.crc_errors', aborting\n", boards[boards_count]->fpga.name);
+        return ret;
+    }
     // Proceed to the next board
     boards_count++;
     return 0;
@@ -21,19 +21,110 @@
 #define LITEXCNC_SPIDEV_NAME    "litexcnc_spidev"
 #define LITEXCNC_SPIDEV_VERSION "1.0.1"
 #define MAX_SPI_BOARDS 4
+// Speed of the SPI bus when it is not given with the connection option `speed`
+#define LITEXCNC_SPIDEV_DEFAULT_SPEED 1800000
+
+// Transfer modes for the cyclic data (connection option `transfer`)
+// - separate: the write and the read are transferred with two ioctls
+#define LITEXCNC_SPI_TRANSFER_SEPARATE 0
+// - combined: the read is added to the message of the write, a single ioctl per cycle
+#define LITEXCNC_SPI_TRANSFER_COMBINED 1
+
+// Commands of the SPI Wishbone bridge on the FPGA, the number of words is added to the
+// command. A single command reads or writes at most LITEXCNC_SPI_MAX_WORDS words.
+#define LITEXCNC_SPI_COMMAND_READ     0x40
+#define LITEXCNC_SPI_COMMAND_WRITE    0x80
+#define LITEXCNC_SPI_COMMAND_MASK     0xC0
+#define LITEXCNC_SPI_MAX_WORDS        31
+// Number of bytes each SPI command adds to the data: the header (command and address)
+// and the bytes in which the bridge responds
+#define LITEXCNC_SPI_HEADER_SIZE      5
+#define LITEXCNC_SPI_RESPONSE_SIZE    2
+#define LITEXCNC_SPI_COMMAND_OVERHEAD (LITEXCNC_SPI_HEADER_SIZE + LITEXCNC_SPI_RESPONSE_SIZE)
+// The response of a read follows the header after a fixed number of bytes (the latency),
+// which is measured when the board is connected. The data directly follows the response.
+#define LITEXCNC_SPI_MAX_LATENCY      2
+#define LITEXCNC_SPI_MAX_READ_OVERHEAD (LITEXCNC_SPI_HEADER_SIZE + LITEXCNC_SPI_MAX_LATENCY + 1)
+// Number of reads of the magic to measure the latency, all reads should give the same result
+#define LITEXCNC_SPI_LATENCY_MEASUREMENTS 8
+#define LITEXCNC_SPI_MAGIC            0x18052022
+// Optional CRC-16/CCITT of the commands (connection option `crc`), requested by setting
+// the highest bit of the address. The CRC covers the header and the data and follows the
+// data of both reads and writes. A write with an incorrect CRC is not acknowledged.
+#define LITEXCNC_SPI_ADDRESS_CRC      0x80000000
+#define LITEXCNC_SPI_CRC_SIZE         2
+#define LITEXCNC_SPI_CRC_INIT         0xFFFF
+#define LITEXCNC_SPI_CRC_POLYNOMIAL   0x1021
+// With the CRC the bridge buffers the words of a write and only writes them to the bus
+// after the CRC has been received, after which it responds. Writing a word takes at most
+// LITEXCNC_SPI_WRITE_CYCLES_PER_WORD cycles of the clock of the FPGA, during which the
+// response is padded. The bridge runs at most at 1/4 of the clock of the FPGA, which
+// limits the padding to LITEXCNC_SPI_MAX_WRITE_PADDING bytes. The response then still
+// fits in the response of a command (LITEXCNC_SPI_MAX_READ_OVERHEAD bytes).
+#define LITEXCNC_SPI_WRITE_CYCLES_PER_WORD 4
+#define LITEXCNC_SPI_MAX_WRITE_PADDING ((LITEXCNC_SPI_MAX_WORDS * LITEXCNC_SPI_WRITE_CYCLES_PER_WORD + 31) / 32)
+#define LITEXCNC_SPI_MAX_WRITE_RESPONSE (LITEXCNC_SPI_RESPONSE_SIZE + LITEXCNC_SPI_MAX_WRITE_PADDING)
+// Space reserved in front of the write buffer for the header of the first command. It
+// is a multiple of a word, so the data in the buffer remains aligned.
+#define LITEXCNC_SPI_BUFFER_HEADER_SIZE 8
+// A command consists of at most four transfers (header, data, CRC and response)
+#define LITEXCNC_SPI_TRANSFERS_PER_COMMAND 4
+#define LITEXCNC_SPI_CACHE_LINE       64
 
 #include <litexcnc.h>
 
+typedef struct {
+    uint8_t header[LITEXCNC_SPI_MAX_READ_OVERHEAD];    // Header, padded for a read
+    uint8_t response[LITEXCNC_SPI_MAX_READ_OVERHEAD];  // Received during the padding (read) or after the data (write)
+    uint8_t crc[LITEXCNC_SPI_CRC_SIZE];  // Sent (write) or received (read) after the data
+    uint8_t *data;  // The data written or the destination of the read data
+    size_t size;
+    bool read;
+} litexcnc_spi_command_t;
+
 typedef struct {
 
     struct {
         struct {
             hal_bit_t debug;  // Indicates the communication is in debug mode
+            hal_s32_t response_latency;
         } param;
+        struct {
+            hal_u32_t *response_errors;  // Commands of which the response was not at the expected position
+            hal_u32_t *crc_errors;       // Reads of which the CRC of the data was incorrect
+        } pin;
     } hal;
 
+    // The number of bytes between the header and the response of a read. When the latency
+    // could not be determined, it is -1 and the response is searched for.
+    int response_latency;
+    size_t read_overhead;
+    // The number of bytes in which the bridge responds to a write of the given number of
+    // words, see LITEXCNC_SPI_WRITE_CYCLES_PER_WORD
+    uint8_t write_response[LITEXCNC_SPI_MAX_WORDS + 1];
+
     // Connection with SPI (in reality this is a file-descriptor)
     int connection;
+    uint32_t speed;
+    bool crc;  // The commands are protected with a CRC
+
+    // Message with the commands for the bridge. Each command consists of multiple
+    // transfers, of which the data is transferred directly from and to the buffers of
+    // the FPGA. All commands are transferred with a single ioctl.
+    litexcnc_spi_command_t *commands;  // Aligned to a cache line
+    void *commands_memory;
+    size_t command_count;
+    size_t max_commands;
+    struct spi_ioc_transfer *transfers;
+    size_t transfer_count;
+    size_t max_transfers;
+
+    // Response of the read commands of a combined transfer, collected by the next read
+    int transfer_mode;  // See LITEXCNC_SPI_TRANSFER_*
+    bool response_pending;
+    size_t response_first;
+    size_t response_count;
+    int64_t response_time_ns;
 
     // Definition of the FPGA (containing pins, steppers, PWM, ec.)
     litexcnc_fpga_t fpga;
@@ -0,0 +1,293 @@
+/********************************************************************
+* Description:  iothread.c
+*               Optional thread which performs the communication with
+*               a FPGA outside the servo thread. The data is exchanged
+*               with the servo thread using lock-free triple buffers.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rtapi_slab.h>
+
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "iothread.h"
+
+
+static void litexcnc_triple_buffer_free(litexcnc_triple_buffer_t *buffer) {
+    for (size_t i=0; i<3; i++) {
+        if (buffer->buffers[i] != NULL) {
+            rtapi_kfree(buffer->buffers[i]);
+            buffer->buffers[i] = NULL;
+        }
+    }
+}
+
+static int litexcnc_triple_buffer_init(litexcnc_triple_buffer_t *buffer, uint8_t *data, size_t size) {
+    // All buffers start as a copy of the buffer of the driver, so the headers prepared
+    // by the driver are present in each buffer
+    for (size_t i=0; i<3; i++) {
+        buffer->buffers[i] = rtapi_kmalloc(size, RTAPI_GFP_KERNEL);
+        if (buffer->buffers[i] == NULL) {
+            litexcnc_triple_buffer_free(buffer);
+            return -ENOMEM;
+        }
+        memcpy(buffer->buffers[i], data, size);
+    }
+    buffer->back = 0;
+    buffer->middle = 1;
+    buffer->front = 2;
+    return 0;
+}
+
+/**
+ * Hands the buffer of the producer over to the consumer. Returns true when the
+ * previously published buffer has not been taken by the consumer.
+ */
+static bool litexcnc_triple_buffer_publish(litexcnc_triple_buffer_t *buffer) {
+    int previous = __atomic_exchange_n(&buffer->middle, buffer->back | LITEXCNC_TRIPLE_BUFFER_FRESH, __ATOMIC_ACQ_REL);
+    buffer->back = previous & LITEXCNC_TRIPLE_BUFFER_INDEX_MASK;
+    return (previous & LITEXCNC_TRIPLE_BUFFER_FRESH) != 0;
+}
+
+/**
+ * Takes the last published buffer for the consumer. Returns false when no buffer has
+ * been published since the last call, the consumer then keeps its current buffer.
+ */
+static bool litexcnc_triple_buffer_consume(litexcnc_triple_buffer_t *buffer) {
+    // Only the consumer clears the flag, so the buffer cannot be taken away between
+    // checking the flag and the exchange
+    if (!(__atomic_load_n(&buffer->middle, __ATOMIC_ACQUIRE) & LITEXCNC_TRIPLE_BUFFER_FRESH)) {
+        return false;
+    }
+    int previous = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL);
+    buffer->front = previous & LITEXCNC_TRIPLE_BUFFER_INDEX_MASK;
+    return true;
+}
+
+
+static void *litexcnc_iothread_run(void *void_litexcnc) {
+    litexcnc_t *litexcnc = void_litexcnc;
+    litexcnc_iothread_t *iothread = litexcnc->iothread;
+
+    // The buffers allocated by the driver, which are restored after each exchange
+    uint8_t *write_buffer = litexcnc->fpga->write_buffer;
+    uint8_t *read_buffer = litexcnc->fpga->read_buffer;
+    int r;
+
+    while (1) {
+        // Wait until the servo thread has data to write
+        while ((sem_wait(&iothread->wakeup) < 0) && (errno == EINTR));
+        if (!__atomic_load_n(&iothread->running, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (!litexcnc_triple_buffer_consume(&iothread->write)) {
+            continue;
+        }
+
+        // Write the data. The transport uses the buffers of the FPGA, which are
+        // replaced by the buffers of the exchange for the duration of the transfer.
+        // The servo thread does not use the buffers of the FPGA while this thread is
+        // running. The read buffer is selected before the write, as transports may
+        // receive the data together with the write.
+        litexcnc->fpga->write_buffer = iothread->write.buffers[iothread->write.front];
+        litexcnc->fpga->read_buffer = iothread->read.buffers[iothread->read.back];
+        litexcnc_prepare_write_runs(litexcnc);
+        if (litexcnc->fpga->write(litexcnc->fpga) < 0) {
+            litexcnc->sparse.refresh = true;
+        }
+
+        // Read the state of the FPGA directly after the write, it is processed by the
+        // servo thread in the next cycle
+        r = litexcnc->fpga->read(litexcnc->fpga);
+        litexcnc->fpga->write_buffer = write_buffer;
+        litexcnc->fpga->read_buffer = read_buffer;
+        if (r < 0) {
+            // A failed read is not handed over, the servo thread then reports the
+            // read as failed. The write may have been lost as well, so the next write
+            // is complete.
+            litexcnc->sparse.refresh = true;
+            continue;
+        }
+        iothread->read_timestamps[iothread->read.back] = litexcnc->fpga->read_timestamp_ns;
+        if (iothread->read_timestamps[iothread->read.back] == 0) {
+            iothread->read_timestamps[iothread->read.back] = litexcnc_wallclock_host_ns();
+        }
+        litexcnc_triple_buffer_publish(&iothread->read);
+    }
+
+    return NULL;
+}
+
+
+int litexcnc_iothread_init(litexcnc_t *litexcnc, int cpu, int priority) {
+
+    // Declarations
+    int r = 0;
+    char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<pin_name>
+
+    // Allocate memory
+    litexcnc->iothread = (litexcnc_iothread_t *)hal_malloc(sizeof(litexcnc_iothread_t));
+    if (litexcnc->iothread == NULL) {
+        LITEXCNC_ERR("Out of memory!\n", litexcnc->fpga->name);
+        return -ENOMEM;
+    }
+    litexcnc_iothread_t *iothread = litexcnc->iothread;
+
+    // Create pins
+    // - missed_reads
+    rtapi_snprintf(name, sizeof(name), "%s.io_thread.missed_reads", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(iothread->hal.pin.missed_reads), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - missed_writes
+    rtapi_snprintf(name, sizeof(name), "%s.io_thread.missed_writes", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(iothread->hal.pin.missed_writes), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+
+    // Create the buffers, the driver must have prepared its buffers
+    r = litexcnc_triple_buffer_init(&iothread->write, litexcnc->fpga->write_buffer, litexcnc->fpga->write_buffer_size + litexcnc->fpga->write_trailer_size);
+    if (r < 0) { goto fail_memory; }
+    r = litexcnc_triple_buffer_init(&iothread->read, litexcnc->fpga->read_buffer, litexcnc->fpga->read_buffer_size + litexcnc->fpga->read_trailer_size);
+    if (r < 0) { goto fail_memory; }
+
+    // Start the thread, preferably with real-time priority
+    sem_init(&iothread->wakeup, 0, 0);
+    iothread->running = 1;
+    pthread_attr_t attr;
+    struct sched_param sched_param;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    if (priority < 0) {
+        priority = sched_get_priority_max(SCHED_FIFO) - LITEXCNC_IOTHREAD_DEFAULT_PRIORITY_OFFSET;
+    }
+    sched_param.sched_priority = priority;
+    pthread_attr_setschedparam(&attr, &sched_param);
+    r = pthread_create(&iothread->thread, &attr, litexcnc_iothread_run, litexcnc);
+    pthread_attr_destroy(&attr);
+    if (r == EPERM) {
+        LITEXCNC_WARN("No permission for a real-time I/O thread, using a normal thread instead.\n", litexcnc->fpga->name);
+        r = pthread_create(&iothread->thread, NULL, litexcnc_iothread_run, litexcnc);
+    }
+    if (r != 0) { goto fail_thread; }
+
+    // The data is read directly after the previous cycle has been written
+    litexcnc->fpga->read_lag = 1;
+
+    // Pin the thread to the requested CPU
+    if (cpu >= 0) {
+#ifdef CPU_SET
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        r = pthread_setaffinity_np(iothread->thread, sizeof(cpuset), &cpuset);
+        if (r != 0) {
+            LITEXCNC_WARN("Could not pin I/O thread to CPU %d: %s\n", litexcnc->fpga->name, cpu, strerror(r));
+        }
+#else
+        LITEXCNC_WARN("Pinning the I/O thread to a CPU is not supported on this platform.\n", litexcnc->fpga->name);
+#endif
+    }
+
+    LITEXCNC_PRINT_NO_DEVICE("Started I/O thread for %s\n", litexcnc->fpga->name);
+    return 0;
+
+fail_pins:
+    LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+    litexcnc->iothread = NULL;
+    return r;
+
+fail_thread:
+    LITEXCNC_ERR("Could not start I/O thread: %s\n", litexcnc->fpga->name, strerror(r));
+    r = -r;
+    sem_destroy(&iothread->wakeup);
+    goto fail_buffers;
+
+fail_memory:
+    LITEXCNC_ERR("Out of memory!\n", litexcnc->fpga->name);
+fail_buffers:
+    litexcnc_triple_buffer_free(&iothread->write);
+    litexcnc_triple_buffer_free(&iothread->read);
+    litexcnc->iothread = NULL;
+    return r;
+}
+
+
+uint8_t *litexcnc_iothread_write_buffer(litexcnc_t *litexcnc) {
+    return litexcnc->iothread->write.buffers[litexcnc->iothread->write.back];
+}
+
+
+void litexcnc_iothread_write(litexcnc_t *litexcnc) {
+    litexcnc_iothread_t *iothread = litexcnc->iothread;
+
+    // Hand the data over to the I/O thread. When the I/O thread has not taken the
+    // data of the previous cycle yet, that data is replaced and will never be written.
+    if (litexcnc_triple_buffer_publish(&iothread->write)) {
+        (*iothread->hal.pin.missed_writes)++;
+    }
+    iothread->started = true;
+    sem_post(&iothread->wakeup);
+}
+
+
+uint8_t *litexcnc_iothread_read(litexcnc_t *litexcnc, int64_t *timestamp_ns) {
+    litexcnc_iothread_t *iothread = litexcnc->iothread;
+
+    // Take the data read since the previous cycle. The I/O thread starts after the
+    // first write, so no data is expected before that.
+    if (!litexcnc_triple_buffer_consume(&iothread->read)) {
+        if (iothread->started) {
+            (*iothread->hal.pin.missed_reads)++;
+        }
+        return NULL;
+    }
+    *timestamp_ns = iothread->read_timestamps[iothread->read.front];
+    return iothread->read.buffers[iothread->read.front];
+}
+
+
+void litexcnc_iothread_stop(litexcnc_t *litexcnc) {
+    litexcnc_iothread_t *iothread = litexcnc->iothread;
+
+    // Wake the thread so it sees it has to stop, and wait until the exchange it might
+    // be busy with has finished. After this the transport can be used directly again.
+    __atomic_store_n(&iothread->running, 0, __ATOMIC_RELEASE);
+    sem_post(&iothread->wakeup);
+    pthread_join(iothread->thread, NULL);
+    sem_destroy(&iothread->wakeup);
+}
@@ -0,0 +1,100 @@
+/********************************************************************
+* Description:  iothread.h
+*               Optional thread which performs the communication with
+*               a FPGA outside the servo thread. The data is exchanged
+*               with the servo thread using lock-free triple buffers.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#ifndef __INCLUDE_LITEXCNC_IOTHREAD_H__
+#define __INCLUDE_LITEXCNC_IOTHREAD_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+
+// Flag in the shared index of a triple buffer, set when the producer has published
+// a buffer which has not been taken by the consumer yet
+#define LITEXCNC_TRIPLE_BUFFER_FRESH      0x04
+#define LITEXCNC_TRIPLE_BUFFER_INDEX_MASK 0x03
+
+// Default priority (SCHED_FIFO) of the I/O thread, relative to the highest priority
+#define LITEXCNC_IOTHREAD_DEFAULT_PRIORITY_OFFSET 1
+
+/**
+ * Triple buffer with a single producer and a single consumer. The producer and the
+ * consumer each own one buffer, the third buffer is shared. A buffer is handed over
+ * by atomically exchanging the owned buffer with the shared one, so neither side ever
+ * waits for the other. When the producer publishes faster than the consumer takes
+ * the data, the consumer gets the newest data.
+ */
+typedef struct {
+    uint8_t *buffers[3];
+    int back;   /* Index of the buffer owned by the producer */
+    int front;  /* Index of the buffer owned by the consumer */
+    int middle; /* Index of the shared buffer, with the flag LITEXCNC_TRIPLE_BUFFER_FRESH */
+} litexcnc_triple_buffer_t;
+
+typedef struct {
+    struct {
+
+        struct {
+            hal_u32_t *missed_reads;  /* Number of cycles in which no new data was read */
+            hal_u32_t *missed_writes; /* Number of cycles of which the data has not been written */
+        } pin;
+
+        struct {
+            // Empty
+        } param;
+
+    } hal;
+
+    // The data written by the servo thread and the data read by the I/O thread
+    litexcnc_triple_buffer_t write;
+    litexcnc_triple_buffer_t read;
+    // Moment the data in each of the read buffers has been sampled (see read_timestamp_ns)
+    int64_t read_timestamps[3];
+
+    pthread_t thread;
+    sem_t wakeup;
+    int running;
+    // Set when the servo thread has handed over data to write at least once
+    bool started;
+
+} litexcnc_iothread_t;
+
+// Functions for starting, using and stopping the I/O thread
+int litexcnc_iothread_init(litexcnc_t *litexcnc, int cpu, int priority);
+uint8_t *litexcnc_iothread_write_buffer(litexcnc_t *litexcnc);
+void litexcnc_iothread_write(litexcnc_t *litexcnc);
+uint8_t *litexcnc_iothread_read(litexcnc_t *litexcnc, int64_t *timestamp_ns);
+void litexcnc_iothread_stop(litexcnc_t *litexcnc);
+
+#endif
@@ -116,7 +116,40 @@ static void litexcnc_config(void* void_litexcnc, long period) {
 }
 
 
-static void litexcnc_read(void* void_litexcnc, long period) {
+static void litexcnc_read_request(void* void_litexcnc, long period) {
+    litexcnc_t *litexcnc = void_litexcnc;
+
+    // The first loop no data is read (see `litexcnc_read_collect`)
+    if (!litexcnc->read_loop_has_run) {
+        return;
+    }
+
+    // Send the request to the FPGA, without waiting for the response. Boards which
+    // cannot split the request from the response perform the whole read when the
+    // data is collected. When the board has an I/O thread, the thread reads the data.
+    if ((litexcnc->iothread == NULL) && (litexcnc->fpga->read_request != NULL)) {
+        litexcnc->fpga->read_request(litexcnc->fpga);
+    }
+}
+
+
+static void litexcnc_process_missed_read(litexcnc_t *litexcnc, long period) {
+    // For a limited number of consecutive failed reads the modules predict their feedback
+    // from the last data received, so a short interruption of the communication does not
+    // lead to a following error. After that the feedback is frozen.
+    bool extrapolate = *(litexcnc->hal.pin.read_misses) <= litexcnc->hal.param.max_extrapolated_reads;
+    if (extrapolate) {
+        litexcnc_wallclock_process_missed_read(litexcnc, period);
+    }
+    for (size_t i=0; i<litexcnc->num_modules; i++) {
+        litexcnc_module_instance_t *module = litexcnc->modules[i];
+        if (module->process_missed_read != NULL) {
+            module->process_missed_read(module->instance_data, extrapolate, period);
+        }
+    }
+}
+
+static void litexcnc_read_collect(void* void_litexcnc, long period) {
     litexcnc_t *litexcnc = void_litexcnc;
 
     // The first loop no data is read, as it is used for sending the configuration to the 
@@ -126,20 +159,50 @@ static void litexcnc_read(void* void_litexcnc, long period) {
         return;
     }
 
-    // Clear buffer (except for the header)
-    memset(
-        litexcnc->fpga->read_buffer + litexcnc->fpga->read_header_size, 
-        0, 
-        litexcnc->fpga->read_buffer_size - litexcnc->fpga->read_header_size
-    );
-    
-    // Read the state from the FPGA
-    litexcnc->fpga->read(litexcnc->fpga);
+    uint8_t *read_buffer;
+    bool read_failed = false;
+    litexcnc->fpga->period = period;
+    if (litexcnc->iothread != NULL) {
+        // Take the data the I/O thread has read since the previous cycle. When there
+        // is no new data, the exchange is counted as missed and nothing is processed.
+        read_buffer = litexcnc_iothread_read(litexcnc, &litexcnc->read_timestamp_ns);
+        if (read_buffer == NULL) {
+            // Before the first write the I/O thread has not read any data yet
+            read_failed = litexcnc->iothread->started;
+        }
+    } else {
+        // Read the state from the FPGA. The buffer is not cleared, a successful read
+        // replaces all data and the data of a failed read is not processed. Transports
+        // which read together with the write of the previous cycle have already
+        // received the data in the buffer.
+        read_buffer = litexcnc->fpga->read_buffer;
+        if (litexcnc->fpga->read(litexcnc->fpga) < 0) {
+            read_buffer = NULL;
+            read_failed = true;
+            // The preceding write may have been lost as well, which goes unnoticed
+            // with sparse writes (UDP). The next write is therefore complete.
+            litexcnc->sparse.refresh = true;
+        }
+        litexcnc->read_timestamp_ns = litexcnc->fpga->read_timestamp_ns;
+        if (litexcnc->read_timestamp_ns == 0) {
+            litexcnc->read_timestamp_ns = litexcnc_wallclock_host_ns();
+        }
+    }
 
-    // TODO: don't process the read data in case the read has failed.
+    // When the read has failed, the data is not processed. The modules keep the values
+    // of the last successful read.
+    *(litexcnc->hal.pin.read_failed) = read_failed;
+    if (read_buffer == NULL) {
+        if (read_failed) {
+            (*(litexcnc->hal.pin.read_misses))++;
+            litexcnc_process_missed_read(litexcnc, period);
+        }
+        return;
+    }
+    *(litexcnc->hal.pin.read_misses) = 0;
 
     // Process the read data for the different compenents
-    uint8_t* pointer = litexcnc->fpga->read_buffer + litexcnc->fpga->read_header_size;
+    uint8_t* pointer = read_buffer + litexcnc->fpga->read_header_size;
     // - default
     litexcnc_watchdog_process_read(litexcnc, &pointer);
     litexcnc_wallclock_process_read(litexcnc, &pointer);
@@ -152,6 +215,62 @@ static void litexcnc_read(void* void_litexcnc, long period) {
     }
 }
 
+/*******************************************************************************
+ * Determines which parts of the write buffer have to be written to the FPGA. The
+ * data is compared with the data of the previous write and the changed words are
+ * combined in runs. The words of the watchdog and of modules which have to be
+ * written every cycle are always included. The complete buffer is written (the
+ * number of runs is zero) when the transport does not support sparse writes, after
+ * the configuration, a failed write or a failed read, when the watchdog has bitten
+ * and once every `write_refresh_interval` cycles, so data which did not arrive is
+ * corrected.
+ *
+ * This function is called directly before the write, by the thread performing it.
+ *
+ * @param litexcnc Pointer to the board of which the data is written.
+ ******************************************************************************/
+static void litexcnc_prepare_write_runs(litexcnc_t *litexcnc) {
+    litexcnc_fpga_t *fpga = litexcnc->fpga;
+    uint8_t *data = fpga->write_buffer + fpga->write_header_size;
+    size_t size = fpga->write_buffer_size - fpga->write_header_size;
+
+    fpga->write_run_count = 0;
+    if (!fpga->sparse_write) {
+        return;
+    }
+
+    // Periodically write the complete buffer
+    litexcnc->sparse.cycles++;
+    if (litexcnc->sparse.refresh ||
+        (litexcnc->hal.param.write_refresh_interval == 0) ||
+        (litexcnc->sparse.cycles >= litexcnc->hal.param.write_refresh_interval) ||
+        *(litexcnc->watchdog->hal.pin.has_bitten)) {
+        memcpy(litexcnc->sparse.previous, data, size);
+        litexcnc->sparse.cycles = 0;
+        litexcnc->sparse.refresh = false;
+        return;
+    }
+
+    // Combine the changed words in runs. Short gaps are written as well, because each
+    // run has an overhead on the link. There is always at least one run, because the
+    // watchdog is written every cycle.
+    litexcnc_write_run_t *run = NULL;
+    for (size_t offset = 0; offset < size; offset += 4) {
+        if (!litexcnc->sparse.always[offset >> 2] && (memcmp(data + offset, litexcnc->sparse.previous + offset, 4) == 0)) {
+            continue;
+        }
+        memcpy(litexcnc->sparse.previous + offset, data + offset, 4);
+        if ((run != NULL) && (offset - (run->offset + run->size) <= 4 * LITEXCNC_WRITE_RUN_MAX_GAP)) {
+            run->size = offset + 4 - run->offset;
+            continue;
+        }
+        run = &fpga->write_runs[fpga->write_run_count++];
+        run->offset = offset;
+        run->size = 4;
+    }
+}
+
+
 static void litexcnc_write(void *void_litexcnc, long period) {
     litexcnc_t *litexcnc = void_litexcnc;
 
@@ -171,15 +290,20 @@ static void litexcnc_write(void *void_litexcnc, long period) {
         return;
     }
 
-    // Clear buffer (except for the header)
+    // Clear buffer (except for the header). When the board has an I/O thread, the
+    // data is prepared in the buffer which is handed over to that thread.
+    uint8_t *write_buffer = litexcnc->fpga->write_buffer;
+    if (litexcnc->iothread != NULL) {
+        write_buffer = litexcnc_iothread_write_buffer(litexcnc);
+    }
     memset(
-        litexcnc->fpga->write_buffer + litexcnc->fpga->write_header_size, 
+        write_buffer + litexcnc->fpga->write_header_size, 
         0, 
         litexcnc->fpga->write_buffer_size - litexcnc->fpga->write_header_size
     );
 
     // Process all functions
-    uint8_t* pointer = litexcnc->fpga->write_buffer + litexcnc->fpga->write_header_size;
+    uint8_t* pointer = write_buffer + litexcnc->fpga->write_header_size;
     // - default
     litexcnc_watchdog_prepare_write(litexcnc, &pointer, period);
     litexcnc_wallclock_prepare_write(litexcnc, &pointer);
@@ -192,7 +316,37 @@ static void litexcnc_write(void *void_litexcnc, long period) {
     }
 
     // Write the data to the FPGA
-    litexcnc->fpga->write(litexcnc->fpga);
+    if (litexcnc->iothread != NULL) {
+        litexcnc_iothread_write(litexcnc);
+    } else {
+        litexcnc_prepare_write_runs(litexcnc);
+        if (litexcnc->fpga->write(litexcnc->fpga) < 0) {
+            litexcnc->sparse.refresh = true;
+        }
+    }
+}
+
+
+static void litexcnc_read_all(void *arg, long period) {
+    struct rtapi_list_head *ptr;
+
+    // First send the requests to all boards, so the boards process their requests at
+    // the same time. Collecting the responses then takes the longest round-trip time
+    // instead of the sum of the round-trip times of all boards.
+    rtapi_list_for_each(ptr, &litexcnc_list) {
+        litexcnc_read_request(rtapi_list_entry(ptr, litexcnc_t, list), period);
+    }
+    rtapi_list_for_each(ptr, &litexcnc_list) {
+        litexcnc_read_collect(rtapi_list_entry(ptr, litexcnc_t, list), period);
+    }
+}
+
+
+static void litexcnc_write_all(void *arg, long period) {
+    struct rtapi_list_head *ptr;
+    rtapi_list_for_each(ptr, &litexcnc_list) {
+        litexcnc_write(rtapi_list_entry(ptr, litexcnc_t, list), period);
+    }
 }
 
 
@@ -435,8 +589,10 @@ int litexcnc_register(litexcnc_fpga_t *fpga) {
     litexcnc->fpga->write_buffer_size += LITEXCNC_WALLCLOCK_DATA_WRITE_SIZE;
     litexcnc->fpga->read_buffer_size += LITEXCNC_WALLCLOCK_DATA_READ_SIZE;
 
-    // - custom modules
+    // - custom modules (the size of the written data of each module is stored to determine
+    //   which data has to be written every cycle, the number of modules fits in a byte)
     litexcnc_module_registration_t *registration;
+    size_t module_write_size[UINT8_MAX + 1] = {0};
     litexcnc->num_modules = header_data.num_modules;
     litexcnc->modules = (litexcnc_module_instance_t**) hal_malloc(litexcnc->num_modules * sizeof(litexcnc_module_instance_t*));;
     for (i = 0; i < litexcnc->num_modules; i ++) {
@@ -459,7 +615,8 @@ int litexcnc_register(litexcnc_fpga_t *fpga) {
             litexcnc->fpga->config_buffer_size += registration->required_config_buffer(litexcnc->modules[i]->instance_data);
         }
         if (registration->required_write_buffer != NULL) {
-            litexcnc->fpga->write_buffer_size += registration->required_write_buffer(litexcnc->modules[i]->instance_data);
+            module_write_size[i] = registration->required_write_buffer(litexcnc->modules[i]->instance_data);
+            litexcnc->fpga->write_buffer_size += module_write_size[i];
         }
         if (registration->required_read_buffer != NULL) {
             litexcnc->fpga->read_buffer_size += registration->required_read_buffer(litexcnc->modules[i]->instance_data);
@@ -492,36 +649,114 @@ int litexcnc_register(litexcnc_fpga_t *fpga) {
     // - write buffer
     LITEXCNC_PRINT_NO_DEVICE(" - Write buffer: %zu bytes\n", litexcnc->fpga->write_buffer_size);
     litexcnc->fpga->write_buffer_size += litexcnc->fpga->write_header_size;
-    uint8_t *write_buffer = rtapi_kmalloc(litexcnc->fpga->write_buffer_size, RTAPI_GFP_KERNEL);
+    uint8_t *write_buffer = rtapi_kmalloc(litexcnc->fpga->write_buffer_size + litexcnc->fpga->write_trailer_size, RTAPI_GFP_KERNEL);
     if (litexcnc == NULL) {
         LITEXCNC_PRINT_NO_DEVICE("out of memory!\n");
         r = -ENOMEM;
         goto fail1;
     }
-    memset(write_buffer, 0, litexcnc->fpga->write_buffer_size);
+    memset(write_buffer, 0, litexcnc->fpga->write_buffer_size + litexcnc->fpga->write_trailer_size);
     litexcnc->fpga->write_buffer = write_buffer;
 
     // - read buffer
     LITEXCNC_PRINT_NO_DEVICE(" - Read buffer: %zu bytes\n", litexcnc->fpga->read_buffer_size);
     litexcnc->fpga->read_buffer_size += litexcnc->fpga->read_header_size;
-    uint8_t *read_buffer = rtapi_kmalloc(litexcnc->fpga->read_buffer_size, RTAPI_GFP_KERNEL);
+    uint8_t *read_buffer = rtapi_kmalloc(litexcnc->fpga->read_buffer_size + litexcnc->fpga->read_trailer_size, RTAPI_GFP_KERNEL);
     if (litexcnc == NULL) {
         LITEXCNC_PRINT_NO_DEVICE("out of memory!\n");
         r = -ENOMEM;
         goto fail1;
     }
-    memset(read_buffer, 0, litexcnc->fpga->read_buffer_size);
+    memset(read_buffer, 0, litexcnc->fpga->read_buffer_size + litexcnc->fpga->read_trailer_size);
     litexcnc->fpga->read_buffer = read_buffer;
 
+    // - sparse writes, only when supported by the transport
+    if (litexcnc->fpga->sparse_write) {
+        size_t write_data_size = litexcnc->fpga->write_buffer_size - litexcnc->fpga->write_header_size;
+        litexcnc->sparse.previous = rtapi_kmalloc(write_data_size, RTAPI_GFP_KERNEL);
+        litexcnc->sparse.always = rtapi_kmalloc(write_data_size >> 2, RTAPI_GFP_KERNEL);
+        litexcnc->fpga->write_runs = rtapi_kmalloc((write_data_size >> 2) * sizeof(litexcnc_write_run_t), RTAPI_GFP_KERNEL);
+        if ((litexcnc->sparse.previous == NULL) || (litexcnc->sparse.always == NULL) || (litexcnc->fpga->write_runs == NULL)) {
+            LITEXCNC_PRINT_NO_DEVICE("out of memory!\n");
+            r = -ENOMEM;
+            goto fail1;
+        }
+        memset(litexcnc->sparse.previous, 0, write_data_size);
+        memset(litexcnc->sparse.always, 0, write_data_size >> 2);
+        // - the FPGA counts down the timeout of the watchdog, so it is written every cycle
+        memset(litexcnc->sparse.always, 1, LITEXCNC_WATCHDOG_DATA_WRITE_SIZE >> 2);
+        size_t write_offset = LITEXCNC_WATCHDOG_DATA_WRITE_SIZE + LITEXCNC_WALLCLOCK_DATA_WRITE_SIZE;
+        for (i = 0; i < litexcnc->num_modules; i++) {
+            if (litexcnc->modules[i]->write_always) {
+                memset(litexcnc->sparse.always + (write_offset >> 2), 1, module_write_size[i] >> 2);
+            }
+            write_offset += module_write_size[i];
+        }
+        litexcnc->sparse.refresh = true;
+    }
+
     
+    // ===========
+    // CREATE PINS
+    // ===========
+    char name[HAL_NAME_LEN + 1];
+    // - read_failed
+    rtapi_snprintf(name, sizeof(name), "%s.read_failed", litexcnc->fpga->name);
+    r = hal_pin_bit_new(name, HAL_OUT, &(litexcnc->hal.pin.read_failed), litexcnc->fpga->comp_id);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+        goto fail1;
+    }
+    // - read_misses
+    rtapi_snprintf(name, sizeof(name), "%s.read_misses", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(litexcnc->hal.pin.read_misses), litexcnc->fpga->comp_id);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+        goto fail1;
+    }
+    // - max_extrapolated_reads (disabled by default)
+    rtapi_snprintf(name, sizeof(name), "%s.max_extrapolated_reads", litexcnc->fpga->name);
+    r = hal_param_u32_new(name, HAL_RW, &(litexcnc->hal.param.max_extrapolated_reads), litexcnc->fpga->comp_id);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding param '%s', aborting\n", name);
+        goto fail1;
+    }
+    litexcnc->hal.param.max_extrapolated_reads = 0;
+    // - write_refresh_interval, only when the transport supports sparse writes
+    if (litexcnc->fpga->sparse_write) {
+        rtapi_snprintf(name, sizeof(name), "%s.write_refresh_interval", litexcnc->fpga->name);
+        r = hal_param_u32_new(name, HAL_RW, &(litexcnc->hal.param.write_refresh_interval), litexcnc->fpga->comp_id);
+        if (r < 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error adding param '%s', aborting\n", name);
+            goto fail1;
+        }
+        litexcnc->hal.param.write_refresh_interval = LITEXCNC_DEFAULT_WRITE_REFRESH_INTERVAL;
+    }
+
     // ================
     // EXPORT FUNCTIONS
     // ================
     LITEXCNC_PRINT_NO_DEVICE("Exporting functions...\n");
-    // - read function
-    char name[HAL_NAME_LEN + 1];
+    // - read function, both requests and collects the data. When the request has already
+    //   been sent (using `read-request` or by the board itself), the data is only collected.
     rtapi_snprintf(name, sizeof(name), "%s.read", litexcnc->fpga->name);
-    r = hal_export_funct(name, litexcnc_read, litexcnc, 1, 0, litexcnc->fpga->comp_id);
+    r = hal_export_funct(name, litexcnc_read_collect, litexcnc, 1, 0, litexcnc->fpga->comp_id);
+    if (r != 0) {
+        LITEXCNC_ERR("error %d exporting read function %s\n", litexcnc->fpga->name, r, name);
+        r = -EINVAL;
+        goto fail1;
+    }
+
+    // - split read functions, so other functions can be run while waiting for the response
+    rtapi_snprintf(name, sizeof(name), "%s.read-request", litexcnc->fpga->name);
+    r = hal_export_funct(name, litexcnc_read_request, litexcnc, 1, 0, litexcnc->fpga->comp_id);
+    if (r != 0) {
+        LITEXCNC_ERR("error %d exporting read function %s\n", litexcnc->fpga->name, r, name);
+        r = -EINVAL;
+        goto fail1;
+    }
+    rtapi_snprintf(name, sizeof(name), "%s.read-collect", litexcnc->fpga->name);
+    r = hal_export_funct(name, litexcnc_read_collect, litexcnc, 1, 0, litexcnc->fpga->comp_id);
     if (r != 0) {
         LITEXCNC_ERR("error %d exporting read function %s\n", litexcnc->fpga->name, r, name);
         r = -EINVAL;
@@ -575,6 +810,60 @@ size_t litexcnc_register_driver(litexcnc_driver_registration_t *registration) {
 }
 
 
+/*******************************************************************************
+ * Splits the options from a connection string. Options are appended to the
+ * connection string after a question mark, i.e. `eth:10.0.0.10?key=value&key=value`.
+ * The connection string is terminated at the question mark, so the driver only
+ * sees the address of the board.
+ *
+ * @param connection_string The connection string, is modified in place.
+ * @return Pointer to the options, or an empty string when no options are given.
+ ******************************************************************************/
+EXPORT_SYMBOL_GPL(litexcnc_split_options);
+char *litexcnc_split_options(char *connection_string) {
+    char *options = strchr(connection_string, '?');
+    if (options == NULL) {
+        return connection_string + strlen(connection_string);
+    }
+    *options = '\0';
+    return options + 1;
+}
+
+
+/*******************************************************************************
+ * Retrieves the value of an option from the options of a connection string. An
+ * option without a value (i.e. `?pipeline`) is reported with the value `1`.
+ *
+ * @param options The options, as returned by `litexcnc_split_options`.
+ * @param key     The name of the option to look up.
+ * @param value   The array where the value is stored in.
+ * @param size    The size of @param value.
+ * @return 1 when the option is found, 0 otherwise.
+ ******************************************************************************/
+EXPORT_SYMBOL_GPL(litexcnc_get_option);
+int litexcnc_get_option(const char *options, const char *key, char *value, size_t size) {
+    size_t key_len = strlen(key);
+    const char *ptr = options;
+    while (ptr && *ptr) {
+        const char *end = strchr(ptr, '&');
+        size_t len = end ? (size_t) (end - ptr) : strlen(ptr);
+        if ((len >= key_len) && (strncmp(ptr, key, key_len) == 0) && ((len == key_len) || (ptr[key_len] == '='))) {
+            if (len == key_len) {
+                rtapi_snprintf(value, size, "1");
+            } else {
+                size_t value_len = len - key_len - 1;
+                if (value_len >= size) value_len = size - 1;
+                memcpy(value, ptr + key_len + 1, value_len);
+                value[value_len] = '\0';
+            }
+            return 1;
+        }
+        ptr = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+
 size_t register_module(char *name) {
     int result;
 
@@ -698,12 +987,51 @@ int rtapi_app_main(void) {
                     return ret;
                 }
             }
+            // Options for the communication which are handled by LitexCNC itself. These
+            // are retrieved before the driver splits the options from the connection string.
+            char value[16];
+            const char *options = strchr(conn_str_ptr, '?');
+            options = options ? options + 1 : "";
+            int io_thread = 0;
+            int io_thread_cpu = -1;
+            int io_thread_priority = -1;
+            if (litexcnc_get_option(options, "thread", value, sizeof(value))) {
+                io_thread = (atoi(value) != 0);
+            }
+            if (litexcnc_get_option(options, "thread_cpu", value, sizeof(value))) {
+                io_thread_cpu = atoi(value);
+            }
+            if (litexcnc_get_option(options, "thread_priority", value, sizeof(value))) {
+                io_thread_priority = atoi(value);
+            }
             // Connect with the board
             ret = registration->initialize_driver(conn_str_ptr, comp_id);
             if (ret<0) {
                 LITEXCNC_ERR_NO_DEVICE("Failed to initialize the driver.\n");
                 return ret;
             }
+            // The board registered by the driver is the last board in the list
+            if (io_thread && (litexcnc_list.next != &litexcnc_list)) {
+                litexcnc_t *board = rtapi_list_entry(litexcnc_list.prev, litexcnc_t, list);
+                ret = litexcnc_iothread_init(board, io_thread_cpu, io_thread_priority);
+                if (ret<0) {
+                    return ret;
+                }
+            }
+        }
+    }
+
+    // Export the functions which read and write all boards at once
+    if (litexcnc_list.next != &litexcnc_list) {
+        ret = hal_export_funct(LITEXCNC_NAME ".read-all", litexcnc_read_all, NULL, 1, 0, comp_id);
+        if (ret != 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error %d exporting function " LITEXCNC_NAME ".read-all\n", ret);
+            return -EINVAL;
+        }
+        ret = hal_export_funct(LITEXCNC_NAME ".write-all", litexcnc_write_all, NULL, 1, 0, comp_id);
+        if (ret != 0) {
+            LITEXCNC_ERR_NO_DEVICE("Error %d exporting function " LITEXCNC_NAME ".write-all\n", ret);
+            return -EINVAL;
         }
     }
 
@@ -721,6 +1049,10 @@ void rtapi_app_exit(void) {
     struct rtapi_list_head *ptr;
     rtapi_list_for_each(ptr, &litexcnc_list) {
         litexcnc_t* board = rtapi_list_entry(ptr, litexcnc_t, list);
+        // The I/O thread is stopped first, so the FPGA can be reset directly
+        if (board->iothread) {
+            litexcnc_iothread_stop(board);
+        }
         litexcnc_reset(board->fpga);
         // Unload driver
         if (board->fpga->terminate) {
@@ -739,3 +1071,4 @@ void rtapi_app_exit(void) {
 // the whole contents of that file into this source-file.
 #include "watchdog.c"
 #include "wallclock.c"
+#include "iothread.c"
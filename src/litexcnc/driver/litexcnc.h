@@ -24,6 +24,7 @@ typedef struct litexcnc_struct litexcnc_t;
 #include "rtapi.h"
 #include <rtapi_list.h>
 
+#include "iothread.h"
 #include "wallclock.h"
 #include "watchdog.h"
 
@@ -33,6 +34,11 @@ typedef struct litexcnc_struct litexcnc_t;
 #define MAX_EXTRAS             32
 #define MAX_CONNECTIONS        4
 
+// Sparse writes: changed words which are separated by at most this number of unchanged
+// words are written as a single run, and the default interval of the full refresh
+#define LITEXCNC_WRITE_RUN_MAX_GAP                  2
+#define LITEXCNC_DEFAULT_WRITE_REFRESH_INTERVAL     100
+
 // ------------------------------------
 // Definitions for printing to command line
 // ------------------------------------
@@ -76,8 +82,15 @@ typedef struct litexcnc_struct litexcnc_t;
 typedef struct litexcnc_module_instance_t {
     int (*prepare_write)(void *instance, uint8_t **data, int period);
     int (*process_read)(void *instance, uint8_t **data, int period);
+    // Called instead of process_read when the read has failed. When extrapolate is true,
+    // the module may predict its feedback from the last data received.
+    int (*process_missed_read)(void *instance, bool extrapolate, int period);
     int (*configure_module)(void *instance, uint8_t **data, int period);
     void *instance_data;
+    // When set, the data of the module is written every cycle, even when it is the same as
+    // in the previous cycle. Required when the FPGA modifies the registers of the module
+    // itself (i.e. flags which are cleared by the FPGA).
+    bool write_always;
 } litexcnc_module_instance_t;
 
 
@@ -110,6 +123,17 @@ typedef struct {
 } litexcnc_driver_registration_t;
 
 
+/**
+ * A run of consecutive words in the write buffer which have to be written to the FPGA.
+ * The offset and size are in bytes, the offset is relative to the start of the data (so
+ * excluding the header of the buffer).
+ */
+typedef struct {
+    size_t offset;
+    size_t size;
+} litexcnc_write_run_t;
+
+
 typedef struct litexcnc_fpga_struct litexcnc_fpga_t;
 struct litexcnc_fpga_struct {
     char name[HAL_NAME_LEN+1];
@@ -123,9 +147,27 @@ struct litexcnc_fpga_struct {
     // - on failure they return FALSE (0) and set *self->io_error (below) to TRUE
     int (*read)(litexcnc_fpga_t *self);
     int (*write)(litexcnc_fpga_t *self);
+    // - optional, sends the request for the read data without waiting for the response.
+    //   The response is collected by the next call to read. When not implemented, the
+    //   read function both requests and receives the data.
+    int (*read_request)(litexcnc_fpga_t *self);
     int (*terminate)(litexcnc_fpga_t *self);
     hal_bit_t *io_error;
 
+    // Number of periods the data in the read buffer lags behind the cycle in which it
+    // is processed. Zero when the data is read at the start of the cycle, one when the
+    // transport already collects the data when the previous cycle is written.
+    int read_lag;
+
+    // The period (in ns) of the thread the read and write functions are running in
+    long period;
+
+    // Estimate of the moment (CLOCK_MONOTONIC, in ns) the FPGA sampled the data in the
+    // read buffer. Set by transports which timestamp the packets, zero when unknown.
+    int64_t read_timestamp_ns;
+    // Estimate of the time (in ns) for written data to arrive at the FPGA, zero when unknown
+    int64_t write_latency_ns;
+
     // Functions which will be called during various stages
     int (*post_register)(litexcnc_fpga_t *self);
 
@@ -141,9 +183,21 @@ struct litexcnc_fpga_struct {
     uint8_t *write_buffer;
     size_t write_header_size;
     size_t write_buffer_size;
+    // - optional, space reserved by the transport after the data of the write buffer. It
+    //   is not part of write_buffer_size.
+    size_t write_trailer_size;
+    // - optional, set by transports which can write parts of the write buffer. Before each
+    //   write the runs which have changed since the previous write are determined. When
+    //   write_run_count is zero, the complete buffer has to be written.
+    bool sparse_write;
+    litexcnc_write_run_t *write_runs;
+    size_t write_run_count;
     uint8_t *read_buffer;
     size_t read_header_size;
     size_t read_buffer_size;
+    // - optional, space reserved by the transport after the data of the read buffer. It
+    //   is not part of read_buffer_size.
+    size_t read_trailer_size;
     
     // For the low-level driver to hang their struct on
     void *private;  
@@ -165,10 +219,37 @@ struct litexcnc_struct {
     bool write_loop_has_run;
     bool read_loop_has_run;
 
+    // Moment (CLOCK_MONOTONIC, in ns) the data which is processed has been sampled by
+    // the FPGA. When the transport cannot estimate this, the moment the data is received.
+    int64_t read_timestamp_ns;
+
+    struct {
+        struct {
+            hal_bit_t *read_failed;  // No valid data has been read from the FPGA in this cycle
+            hal_u32_t *read_misses;  // Number of consecutive cycles in which the read has failed
+        } pin;
+        struct {
+            hal_u32_t max_extrapolated_reads;  // Number of failed reads for which the feedback is extrapolated
+            hal_u32_t write_refresh_interval;  // Number of cycles between full writes (0 disables sparse writes)
+        } param;
+    } hal;
+
+    // Administration of the sparse writes, only used when the transport supports these
+    struct {
+        uint8_t *previous;       // Data which has been written to the FPGA in the previous write
+        uint8_t *always;         // For each word, whether it has to be written every cycle
+        uint32_t cycles;         // Number of writes since the last full write
+        bool refresh;            // The next write has to write the complete buffer
+    } sparse;
+
     // Default litexcnc modules
     litexcnc_watchdog_t *watchdog;
     litexcnc_wallclock_t *wallclock;
 
+    // Optional thread which performs the communication with the FPGA (NULL when the
+    // communication is performed by the servo thread)
+    litexcnc_iothread_t *iothread;
+
     struct rtapi_list_head list;
 };
 
@@ -217,5 +298,7 @@ int litexcnc_register(litexcnc_fpga_t *fpga);
 void litexcnc_unregister(litexcnc_fpga_t *fpga);
 size_t litexcnc_register_module(litexcnc_module_registration_t *module);
 size_t litexcnc_register_driver(litexcnc_driver_registration_t *driver);
+char *litexcnc_split_options(char *connection_string);
+int litexcnc_get_option(const char *options, const char *key, char *value, size_t size);
 
 #endif
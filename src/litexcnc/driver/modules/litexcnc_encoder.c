@@ -133,7 +133,10 @@ size_t litexcnc_encoder_init(litexcnc_module_instance_t **module, litexcnc_t *li
     (*module) = (litexcnc_module_instance_t *)hal_malloc(sizeof(litexcnc_module_instance_t));
     (*module)->prepare_write = &litexcnc_encoder_prepare_write;
     (*module)->process_read  = &litexcnc_encoder_process_read;
+    (*module)->process_missed_read = &litexcnc_encoder_process_missed_read;
     (*module)->instance_data = hal_malloc(sizeof(litexcnc_encoder_t));
+    // The FPGA clears the `index enable`-flags itself, so these are written every cycle
+    (*module)->write_always = true;
         
     // Cast from void to correct type and store it
     litexcnc_encoder_t *encoder = (litexcnc_encoder_t *) (*module)->instance_data;
@@ -166,6 +169,7 @@ size_t litexcnc_encoder_init(litexcnc_module_instance_t **module, litexcnc_t *li
         LITEXCNC_CREATE_HAL_PIN("velocity", float, HAL_OUT, &(instance->hal.pin.velocity))
         LITEXCNC_CREATE_HAL_PIN("velocity-rpm", float, HAL_OUT, &(instance->hal.pin.velocity_rpm))
         LITEXCNC_CREATE_HAL_PIN("overflow-occurred", bit, HAL_OUT, &(instance->hal.pin.overflow_occurred))
+        LITEXCNC_CREATE_HAL_PIN("feedback-extrapolated", bit, HAL_OUT, &(instance->hal.pin.feedback_extrapolated))
 
         // Create the params
         LITEXCNC_CREATE_HAL_PARAM("position-scale", float, HAL_RW, &(instance->hal.param.position_scale))
@@ -278,6 +282,12 @@ int litexcnc_encoder_process_read(void *module, uint8_t **data, int period) {
         *(instance->hal.pin.counts) -= instance->memo.position_reset;
 
         // Calculate the new position based on the counts
+        // - after failed reads the position has been extrapolated, continue from the last
+        //   position calculated from data of the FPGA
+        if (encoder->memo.missed_reads) {
+            *(instance->hal.pin.position) = instance->memo.position_measured;
+            *(instance->hal.pin.feedback_extrapolated) = false;
+        }
         // - store the previous position (requered for the velocity calculation)
         float position_old = *(instance->hal.pin.position);
         // - when an index pulse has been received the roll-over protection is disabled,
@@ -322,8 +332,9 @@ int litexcnc_encoder_process_read(void *module, uint8_t **data, int period) {
         // means there is a large jump in position and thus to a large theoretical 
         // speed.
         if (!(*(instance->hal.pin.index_pulse))) {
-            // Replace the element in the array
-            instance->memo.velocity[encoder->memo.velocity_pointer] = (*(instance->hal.pin.position) - position_old) * encoder->data.recip_dt;
+            // Replace the element in the array. After failed reads the change in position
+            // is spread over all periods since the last successful read.
+            instance->memo.velocity[encoder->memo.velocity_pointer] = (*(instance->hal.pin.position) - position_old) * encoder->data.recip_dt / (encoder->memo.missed_reads + 1);
             // Sum the array and divide by the size of the array
             float average = 0.0;
             for (size_t j=0; j < LITEXCNC_ENCODER_POSITION_AVERAGE_SIZE; j++) {average += instance->memo.velocity[j];};
@@ -333,6 +344,34 @@ int litexcnc_encoder_process_read(void *module, uint8_t **data, int period) {
             // the array
             if (encoder->memo.velocity_pointer++ >= LITEXCNC_ENCODER_POSITION_AVERAGE_SIZE) {encoder->memo.velocity_pointer=0;};
         }
+        instance->memo.position_measured = *(instance->hal.pin.position);
+    }
+    encoder->memo.missed_reads = 0;
+
+    return 0;
+}
+
+
+int litexcnc_encoder_process_missed_read(void *module, bool extrapolate, int period) {
+    /* ENCODER PROCESS MISSED READ
+     * This function is called when no data has been received from the FPGA. When
+     * requested, the position is extrapolated with the last (averaged) velocity. The
+     * velocity itself is kept. The counts are not changed, as these are only known from
+     * the FPGA.
+     */
+    static litexcnc_encoder_t *encoder;
+    encoder = (litexcnc_encoder_t *) module;
+
+    encoder->memo.missed_reads++;
+    if (!extrapolate) {
+        return 0;
+    }
+    for (size_t i=0; i < encoder->num_instances; i++) {
+        litexcnc_encoder_instance_t *instance = &(encoder->instances[i]);
+        *(instance->hal.pin.position) += *(instance->hal.pin.velocity) * period * 0.000000001;
+        *(instance->hal.pin.feedback_extrapolated) = true;
+        // The index pulse has not been seen
+        *(instance->hal.pin.index_pulse) = false;
     }
 
     return 0;
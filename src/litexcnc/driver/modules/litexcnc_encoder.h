@@ -108,6 +108,10 @@ typedef struct {
              * of 60 for convenience.
              */
             hal_bit_t *overflow_occurred;
+            /* When true, the position and velocity are not read from the FPGA, but predicted
+             * from the last velocity, because the read has failed (see max_extrapolated_reads).
+             */
+            hal_bit_t *feedback_extrapolated;
         } pin;
 
         struct {
@@ -136,6 +140,7 @@ typedef struct {
         hal_float_t position_scale;
         hal_float_t velocity[LITEXCNC_ENCODER_POSITION_AVERAGE_SIZE];
         size_t velocity_pointer;
+        hal_float_t position_measured; /** The last position calculated from data of the FPGA */
     } memo;
 
 
@@ -154,6 +159,7 @@ typedef struct {
     struct {
         long period; /** period of a single cycle */
         size_t velocity_pointer;
+        size_t missed_reads; /** number of reads which have failed since the last successful read */
     } memo;
 } litexcnc_encoder_t;
 
@@ -237,4 +243,15 @@ int litexcnc_encoder_prepare_write(void *instance, uint8_t **data, int period);
  ******************************************************************************/
 int litexcnc_encoder_process_read(void *instance, uint8_t** data, int period);
 
+
+/*******************************************************************************
+ * Processes a failed read. The position is extrapolated with the last velocity
+ * when requested, otherwise the feedback is kept.
+ *
+ * @param instance The structure containing the data on the module instance
+ * @param extrapolate When true, the position is extrapolated
+ * @param period Period in nano-seconds of a cycle
+ ******************************************************************************/
+int litexcnc_encoder_process_missed_read(void *instance, bool extrapolate, int period);
+
 #endif
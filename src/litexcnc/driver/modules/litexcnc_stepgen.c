@@ -361,6 +361,107 @@ int litexcnc_stepgen_prepare_write(void *module, uint8_t **data, int period) {
 }
 
 
+static uint64_t litexcnc_stepgen_next_apply_time(litexcnc_stepgen_t *stepgen) {
+    static uint64_t lag_cycles;
+    static uint64_t apply_time;
+    static uint64_t arrival_time;
+
+    // The next apply time is basically chosen so that the next loop starts exactly when it
+    // should (according to the timing of the previous loop). When the read data lags behind
+    // (i.e. it was already collected when the previous cycle was written), the wallclock is
+    // older and the apply time is shifted accordingly. The time between the two last reads
+    // on the FPGA is the best estimate for this shift, the period is used as fall-back.
+    lag_cycles = *(stepgen->data.read_lag) * stepgen->data.cycles_per_period;
+    if (*(stepgen->data.read_lag)
+        && (*(stepgen->data.wallclock_ticks_delta) > 0)
+        && (*(stepgen->data.wallclock_ticks_delta) < 2 * stepgen->data.cycles_per_period)) {
+        lag_cycles = *(stepgen->data.read_lag) * *(stepgen->data.wallclock_ticks_delta);
+    }
+    apply_time = 0.75 * stepgen->data.cycles_per_period + lag_cycles + *(stepgen->data.wallclock_ticks);
+
+    // When the wall clock is locked to the clock of the host, the moment the data arrives
+    // at the FPGA can be predicted. The FPGA applies data which arrives after the apply
+    // time directly, so the prediction of the position is made for that moment instead.
+    if (*(stepgen->data.litexcnc->wallclock->hal.pin.locked)) {
+        arrival_time = litexcnc_wallclock_predict_write_ticks(stepgen->data.litexcnc);
+        if ((int64_t) (arrival_time - apply_time) > 0) {
+            apply_time = arrival_time;
+        }
+    }
+    return apply_time;
+}
+
+
+static void litexcnc_stepgen_predict(litexcnc_stepgen_t *stepgen, litexcnc_stepgen_instance_t *instance, uint64_t next_apply_time) {
+    // - parameters for determining the position end start of next loop
+    static uint64_t min_time;
+    static uint64_t max_time;
+    static float fraction;
+    static float speed_end;
+
+    /* -------------------
+     * Predict the position and speed at the theoretical end of the start of the 
+     * update period. The prediction is based on:
+     *    - if there is a pending apply time (apply_time > wall_clock) the movement until that
+     *      apply time based on the position, speed and acceleration as read from the FPGA.
+     *    - any movement (with respect to speed and acceleration) which happens until the next
+     *      apply time, which is typically equal to the period of the function.
+     *
+     * This function is placed under read, as it uses the output from the previous cycle. If this
+     * was to be placed under the write cycle, errors might occur if the input variables such
+     * as the acceleration would change between read and write.
+     * ------------------- 
+     */
+    // - start with the current speed and position
+    *(instance->hal.pin.speed_prediction) = *(instance->hal.pin.speed_fb);
+    *(instance->hal.pin.position_prediction) =  *(instance->hal.pin.position_fb);
+    
+    // Add the different phases to the speed and position prediction
+    if (*(instance->hal.pin.debug)) {
+        rtapi_print("Timings: %.6f, %" PRIu64 ", %" PRIu64 ", %" PRIu32 ", %" PRIu64 "\n",
+            stepgen->data.period_s,
+            *(stepgen->data.wallclock_ticks),
+            stepgen->memo.apply_time,
+            instance->data.fpga_time,
+            next_apply_time
+        );
+    }
+    if (*(stepgen->data.wallclock_ticks) <= stepgen->memo.apply_time + instance->data.fpga_time) {
+        min_time = *(stepgen->data.wallclock_ticks);
+        if (stepgen->memo.apply_time > min_time) {
+            min_time = stepgen->memo.apply_time;
+        }
+        max_time = stepgen->memo.apply_time + instance->data.fpga_time;
+        if (next_apply_time < max_time) {
+            max_time = next_apply_time;
+        }
+        if ((stepgen->memo.apply_time + instance->data.fpga_time - min_time) <= 0) {
+            fraction = 1.0;
+        } else {
+            fraction = (float) (max_time - min_time) / (stepgen->memo.apply_time + instance->data.fpga_time - min_time);
+        }
+        speed_end = (1.0 - fraction) * *(instance->hal.pin.speed_prediction) + fraction * instance->data.flt_speed;
+        *(instance->hal.pin.position_prediction) += 0.5 * (*(instance->hal.pin.speed_prediction) + speed_end) * (max_time - min_time) * (*(stepgen->data.clock_frequency_recip));
+        *(instance->hal.pin.speed_prediction) = speed_end;
+    }
+    if (next_apply_time > stepgen->memo.apply_time + instance->data.fpga_time) {
+        // Some constant speed should be added
+        *(instance->hal.pin.speed_prediction) = instance->data.flt_speed;
+        *(instance->hal.pin.position_prediction) += instance->data.flt_speed * (next_apply_time - (stepgen->memo.apply_time + instance->data.fpga_time)) * (*(stepgen->data.clock_frequency_recip));
+    }
+    if (*(instance->hal.pin.debug)) {
+        rtapi_print("Stepgen speed feedback result: %" PRIu64 ", %" PRIu64 ", %.6f, %.6f, %.6f, %.6f \n",
+            *(stepgen->data.wallclock_ticks),
+            next_apply_time,
+            *(instance->hal.pin.speed_fb),
+            *(instance->hal.pin.speed_prediction),
+            *(instance->hal.pin.position_fb),
+            *(instance->hal.pin.position_prediction)
+        );
+    }
+}
+
+
 int litexcnc_stepgen_process_read(void *module, uint8_t **data, int period) {
     
     static litexcnc_stepgen_t *stepgen;
@@ -368,16 +469,10 @@ int litexcnc_stepgen_process_read(void *module, uint8_t **data, int period) {
 
     // Declarations
     static uint64_t next_apply_time;
-    static int32_t loop_cycles;
     static litexcnc_stepgen_instance_t *instance;
     //  - parameters for retrieving data from FPGA
     static int64_t pos;
     static uint32_t speed;
-    // - parameters for determining the position end start of next loop
-    static uint64_t min_time;
-    static uint64_t max_time;
-    static float fraction;
-    static float speed_end;
 
     // Check for the first cycle and calculate some fake timings. This has to be done at
     // this location, because in the init the wallclock_ticks is still zero and this would
@@ -385,10 +480,7 @@ int litexcnc_stepgen_process_read(void *module, uint8_t **data, int period) {
     if (stepgen->memo.apply_time == 0) {
         stepgen->memo.apply_time = - 0.1 * stepgen->data.cycles_per_period + *(stepgen->data.wallclock_ticks) ;
     }
-
-    // The next apply time is basically chosen so that the next loop starts exactly when it
-    // should (according to the timing of the previous loop).
-    next_apply_time = 0.75 * stepgen->data.cycles_per_period + *(stepgen->data.wallclock_ticks) ;
+    next_apply_time = litexcnc_stepgen_next_apply_time(stepgen);
 
     // Receive and process the data for all the stepgens
     for (size_t i=0; i<stepgen->num_instances; i++) {
@@ -431,71 +523,99 @@ int litexcnc_stepgen_process_read(void *module, uint8_t **data, int period) {
         // *(instance->hal.pin.position_fb) = (double)(instance->data.position-(1LL<<(instance->data.pick_off_pos-1))) * instance->data.scale_recip / (1LL << instance->data.pick_off_pos);
         *(instance->hal.pin.position_fb) = (double) instance->data.position * instance->data.fpga_pos_scale_inv;
         *(instance->hal.pin.speed_fb) = (double) instance->data.speed * instance->data.fpga_speed_scale_inv;
+        *(instance->hal.pin.feedback_extrapolated) = false;
+
+        // Predict the position and speed at the next apply time
+        litexcnc_stepgen_predict(stepgen, instance, next_apply_time);
+    }
+
+    // Push the apply for the write loop
+    stepgen->memo.apply_time = next_apply_time;
+    stepgen->memo.wallclock_ticks = *(stepgen->data.wallclock_ticks);
+
+    return 0;
+}
+
+
+int litexcnc_stepgen_process_missed_read(void *module, bool extrapolate, int period) {
+
+    static litexcnc_stepgen_t *stepgen;
+    stepgen = (litexcnc_stepgen_t *) module;
+
+    // Declarations
+    static uint64_t next_apply_time;
+    static litexcnc_stepgen_instance_t *instance;
+    static uint64_t start_time;
+    static uint64_t end_time;
+    static uint64_t ramp_end_time;
+    static float speed_start;
+    static float speed_end;
+
+    // The feedback is kept when it should not be extrapolated, or when the wall clock has
+    // not been advanced (no data has been received yet)
+    if (!extrapolate || (stepgen->memo.apply_time == 0) || (*(stepgen->data.wallclock_ticks) <= stepgen->memo.wallclock_ticks)) {
+        return 0;
+    }
+    end_time = *(stepgen->data.wallclock_ticks);
+    next_apply_time = litexcnc_stepgen_next_apply_time(stepgen);
+
+    for (size_t i=0; i<stepgen->num_instances; i++) {
+        instance = &(stepgen->instances[i]);
 
         /* -------------------
-         * Predict the position and speed at the theoretical end of the start of the 
-         * update period. The prediction is based on:
-         *    - if there is a pending apply time (apply_time > wall_clock) the movement until that
-         *      apply time based on the position, speed and acceleration as read from the FPGA.
-         *    - any movement (with respect to speed and acceleration) which happens until the next
-         *      apply time, which is typically equal to the period of the function.
-         *
-         * This function is placed under read, as it uses the output from the previous cycle. If this
-         * was to be placed under the write cycle, errors might occur if the input variables such
-         * as the acceleration would change between read and write.
-         * ------------------- 
+         * Extrapolate the feedback from the moment of the last feedback to the moment the
+         * data would have been read, using the motion the FPGA has been commanded:
+         *    - until the apply time of the last write the speed changes linearly from the
+         *      feedback to the prediction made for the apply time;
+         *    - from the apply time the speed changes linearly to the commanded speed,
+         *      which is reached after fpga_time;
+         *    - after that the commanded speed is kept.
+         * -------------------
          */
-        // - start with the current speed and position
-        *(instance->hal.pin.speed_prediction) = *(instance->hal.pin.speed_fb);
-        *(instance->hal.pin.position_prediction) =  *(instance->hal.pin.position_fb);
-        
-        // Add the different phases to the speed and position prediction
-        if (*(instance->hal.pin.debug)) {
-            rtapi_print("Timings: %.6f, %" PRIu64 ", %" PRIu64 ", %" PRIu32 ", %" PRIu64 "\n",
-                stepgen->data.period_s,
-                *(stepgen->data.wallclock_ticks),
-                stepgen->memo.apply_time,
-                instance->data.fpga_time,
-                next_apply_time
-            );
-        }
-        if (*(stepgen->data.wallclock_ticks) <= stepgen->memo.apply_time + instance->data.fpga_time) {
-            min_time = *(stepgen->data.wallclock_ticks);
-            if (stepgen->memo.apply_time > min_time) {
-                min_time = stepgen->memo.apply_time;
-            }
-            max_time = stepgen->memo.apply_time + instance->data.fpga_time;
-            if (next_apply_time < max_time) {
-                max_time = next_apply_time;
-            }
-            if ((stepgen->memo.apply_time + instance->data.fpga_time - min_time) <= 0) {
-                fraction = 1.0;
+        start_time = stepgen->memo.wallclock_ticks;
+        speed_start = *(instance->hal.pin.speed_fb);
+        if (stepgen->memo.apply_time > start_time) {
+            if (end_time <= stepgen->memo.apply_time) {
+                speed_end = speed_start + (*(instance->hal.pin.speed_prediction) - speed_start) * (float) (end_time - start_time) / (stepgen->memo.apply_time - start_time);
+                *(instance->hal.pin.position_fb) += 0.5 * (speed_start + speed_end) * (end_time - start_time) * (*(stepgen->data.clock_frequency_recip));
+                *(instance->hal.pin.speed_fb) = speed_end;
+                start_time = end_time;
             } else {
-                fraction = (float) (max_time - min_time) / (stepgen->memo.apply_time + instance->data.fpga_time - min_time);
+                *(instance->hal.pin.position_fb) = *(instance->hal.pin.position_prediction);
+                speed_start = *(instance->hal.pin.speed_prediction);
+                start_time = stepgen->memo.apply_time;
             }
-            speed_end = (1.0 - fraction) * *(instance->hal.pin.speed_prediction) + fraction * instance->data.flt_speed;
-            *(instance->hal.pin.position_prediction) += 0.5 * (*(instance->hal.pin.speed_prediction) + speed_end) * (max_time - min_time) * (*(stepgen->data.clock_frequency_recip));
-            *(instance->hal.pin.speed_prediction) = speed_end;
         }
-        if (next_apply_time > stepgen->memo.apply_time + instance->data.fpga_time) {
-            // Some constant speed should be added
-            *(instance->hal.pin.speed_prediction) = instance->data.flt_speed;
-            *(instance->hal.pin.position_prediction) += instance->data.flt_speed * (next_apply_time - (stepgen->memo.apply_time + instance->data.fpga_time)) * (*(stepgen->data.clock_frequency_recip));
+        if (start_time < end_time) {
+            ramp_end_time = stepgen->memo.apply_time + instance->data.fpga_time;
+            if (start_time < ramp_end_time) {
+                if (end_time < ramp_end_time) {
+                    speed_end = speed_start + (instance->data.flt_speed - speed_start) * (float) (end_time - start_time) / (ramp_end_time - start_time);
+                } else {
+                    speed_end = instance->data.flt_speed;
+                }
+                uint64_t ramp_time = ((end_time < ramp_end_time) ? end_time : ramp_end_time) - start_time;
+                *(instance->hal.pin.position_fb) += 0.5 * (speed_start + speed_end) * ramp_time * (*(stepgen->data.clock_frequency_recip));
+                start_time += ramp_time;
+                speed_start = speed_end;
+            }
+            // Constant speed for the remainder
+            *(instance->hal.pin.position_fb) += speed_start * (end_time - start_time) * (*(stepgen->data.clock_frequency_recip));
+            *(instance->hal.pin.speed_fb) = speed_start;
         }
-        if (*(instance->hal.pin.debug)) {
-            rtapi_print("Stepgen speed feedback result: %" PRIu64 ", %" PRIu64 ", %.6f, %.6f, %.6f, %.6f \n",
-                *(stepgen->data.wallclock_ticks),
-                next_apply_time,
-                *(instance->hal.pin.speed_fb),
-                *(instance->hal.pin.speed_prediction),
-                *(instance->hal.pin.position_fb),
-                *(instance->hal.pin.position_prediction)
-            );
+        *(instance->hal.pin.feedback_extrapolated) = true;
+        // The index pulse has not been seen
+        if (instance->memo.has_index) {
+            *(instance->hal.pin.index_pulse) = false;
         }
+
+        // Predict the position and speed at the next apply time
+        litexcnc_stepgen_predict(stepgen, instance, next_apply_time);
     }
 
     // Push the apply for the write loop
     stepgen->memo.apply_time = next_apply_time;
+    stepgen->memo.wallclock_ticks = end_time;
 
     return 0;
 }
@@ -511,6 +631,7 @@ size_t litexcnc_stepgen_init(litexcnc_module_instance_t **module, litexcnc_t *li
     (*module) = (litexcnc_module_instance_t *)hal_malloc(sizeof(litexcnc_module_instance_t));
     (*module)->prepare_write    = &litexcnc_stepgen_prepare_write;
     (*module)->process_read     = &litexcnc_stepgen_process_read;
+    (*module)->process_missed_read = &litexcnc_stepgen_process_missed_read;
     (*module)->configure_module = &litexcnc_stepgen_config;
     (*module)->instance_data = hal_malloc(sizeof(litexcnc_stepgen_t));
         
@@ -521,9 +642,12 @@ size_t litexcnc_stepgen_init(litexcnc_module_instance_t **module, litexcnc_t *li
 
     // Store pointers to data from FPGA required by the process
     stepgen->data.fpga_name = litexcnc->fpga->name;
+    stepgen->data.litexcnc = litexcnc;
     stepgen->data.clock_frequency = &(litexcnc->clock_frequency);
     stepgen->data.clock_frequency_recip = &(litexcnc->clock_frequency_recip);
     stepgen->data.wallclock_ticks = &(litexcnc->wallclock->memo.wallclock_ticks);
+    stepgen->data.wallclock_ticks_delta = &(litexcnc->wallclock->memo.wallclock_ticks_delta);
+    stepgen->data.read_lag = &(litexcnc->fpga->read_lag);
 
     // Store the amount of stepgen instances on this board and allocate HAL shared memory
     stepgen->num_instances = *(*config);
@@ -565,6 +689,7 @@ size_t litexcnc_stepgen_init(litexcnc_module_instance_t **module, litexcnc_t *li
         LITEXCNC_CREATE_HAL_PIN("position-prediction", float, HAL_OUT, &(instance->hal.pin.position_prediction));
         LITEXCNC_CREATE_HAL_PIN("velocity-feedback", float, HAL_OUT, &(instance->hal.pin.speed_fb));
         LITEXCNC_CREATE_HAL_PIN("velocity-prediction", float, HAL_OUT, &(instance->hal.pin.speed_prediction));
+        LITEXCNC_CREATE_HAL_PIN("feedback-extrapolated", bit, HAL_OUT, &(instance->hal.pin.feedback_extrapolated));
         LITEXCNC_CREATE_HAL_PIN("enable", bit, HAL_IN, &(instance->hal.pin.enable));
         LITEXCNC_CREATE_HAL_PIN("velocity-mode", bit, HAL_IN, &(instance->hal.pin.velocity_mode));
         LITEXCNC_CREATE_HAL_PIN("position-cmd", float, HAL_IN, &(instance->hal.pin.position_cmd));
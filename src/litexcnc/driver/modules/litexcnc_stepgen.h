@@ -70,6 +70,7 @@ typedef struct {
             hal_bit_t   *debug;               /* Flag indicating whether all positional data will be printed to the command line */
             hal_bit_t   *index_enable;        /* When true, a rising edge will reset the counter of the stepgen to zero. */
             hal_bit_t   *index_pulse;         /* When true, a rising edge has been detected on the FPGA. This flag will be active until the index-enable is set to False. */ 
+            hal_bit_t   *feedback_extrapolated; /* When true, the position and speed feedback are not read from the FPGA, but extrapolated from the commanded motion, because the read has failed. */
         } pin;
         /** Structure defining the HAL params */
         struct {
@@ -158,14 +159,18 @@ typedef struct {
         uint32_t steplen_cycles;
         uint32_t stepspace_cycles;
         uint64_t apply_time;
+        uint64_t wallclock_ticks;  /* The moment (wall clock) of the position and speed feedback */
     } memo;
     
     // Struct containing pre-calculated values
     struct {
         char *fpga_name;
+        litexcnc_t *litexcnc;
         uint32_t *clock_frequency;
         float *clock_frequency_recip;
         uint64_t *wallclock_ticks;
+        uint64_t *wallclock_ticks_delta;
+        int *read_lag;
         float period_s;
         float period_s_recip;
         float cycles_per_period;
@@ -291,4 +296,16 @@ int litexcnc_stepgen_prepare_write(void *instance, uint8_t **data, int period);
  ******************************************************************************/
 int litexcnc_stepgen_process_read(void *instance, uint8_t** data, int period);
 
+
+/*******************************************************************************
+ * Processes a failed read. When requested, the position and speed feedback are
+ * extrapolated from the motion commanded to the FPGA, otherwise the feedback is
+ * kept.
+ *
+ * @param instance The structure containing the data on the module instance
+ * @param extrapolate When true, the feedback is extrapolated
+ * @param period Period in nano-seconds of a cycle
+ ******************************************************************************/
+int litexcnc_stepgen_process_missed_read(void *instance, bool extrapolate, int period);
+
 #endif
\ No newline at end of file
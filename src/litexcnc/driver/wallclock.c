@@ -35,13 +35,18 @@
     This code was written as part of the LiteX-CNC project.
 */
 #include <stdio.h>
+#include <time.h>
 
 #include "rtapi.h"
 #include "rtapi_app.h"
+#include "rtapi_math.h"
 #include "litexcnc.h"
 
 #include "wallclock.h"
 
+// The first board, to which the moments the other boards sample their data are compared
+static litexcnc_t *reference_board = NULL;
+
 
 int litexcnc_wallclock_init(litexcnc_t *litexcnc) {
     
@@ -61,6 +66,30 @@ int litexcnc_wallclock_init(litexcnc_t *litexcnc) {
     rtapi_snprintf(name, sizeof(name), "%s.wallclock.ticks_lsb", litexcnc->fpga->name); 
     r = hal_pin_u32_new(name, HAL_IO, &(litexcnc->wallclock->hal.pin.wallclock_ticks_lsb), litexcnc->fpga->comp_id); 
     if (r < 0) { goto fail_pins; }
+    // - offset_s
+    rtapi_snprintf(name, sizeof(name), "%s.wallclock.offset_s", litexcnc->fpga->name);
+    r = hal_pin_float_new(name, HAL_OUT, &(litexcnc->wallclock->hal.pin.offset_s), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - drift_ppm
+    rtapi_snprintf(name, sizeof(name), "%s.wallclock.drift_ppm", litexcnc->fpga->name);
+    r = hal_pin_float_new(name, HAL_OUT, &(litexcnc->wallclock->hal.pin.drift_ppm), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - jitter_ns
+    rtapi_snprintf(name, sizeof(name), "%s.wallclock.jitter_ns", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(litexcnc->wallclock->hal.pin.jitter_ns), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - locked
+    rtapi_snprintf(name, sizeof(name), "%s.wallclock.locked", litexcnc->fpga->name);
+    r = hal_pin_bit_new(name, HAL_OUT, &(litexcnc->wallclock->hal.pin.locked), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - skew_ns
+    rtapi_snprintf(name, sizeof(name), "%s.wallclock.skew_ns", litexcnc->fpga->name);
+    r = hal_pin_s32_new(name, HAL_OUT, &(litexcnc->wallclock->hal.pin.skew_ns), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+
+    if (reference_board == NULL) {
+        reference_board = litexcnc;
+    }
 
     return 0;
     
@@ -79,6 +108,135 @@ uint8_t litexcnc_wallclock_prepare_write(litexcnc_t *litexcnc, uint8_t **data) {
     return 0;
 }
 
+static void litexcnc_wallclock_restart(litexcnc_wallclock_estimator_t *estimator, double nominal_ns_per_tick, uint64_t ticks, int64_t host_ns) {
+    memset(estimator, 0, sizeof(*estimator));
+    estimator->valid = true;
+    estimator->ticks_ref = ticks;
+    estimator->host_ns_ref = host_ns;
+    estimator->ns_per_tick = nominal_ns_per_tick;
+    estimator->nominal_ns_per_tick = nominal_ns_per_tick;
+}
+
+/**
+ * Fits a straight line through the best samples of the blocks in the window. The
+ * samples are taken relative to the oldest sample and to the nominal frequency, so
+ * the fit only has to resolve small numbers. Samples which deviate too much from a
+ * first fit are left out of a second fit.
+ */
+static void litexcnc_wallclock_fit(litexcnc_wallclock_estimator_t *estimator) {
+    size_t oldest = (estimator->window_filled < LITEXCNC_WALLCLOCK_WINDOW_SIZE) ? 0 : estimator->window_index;
+    size_t newest = (estimator->window_index + LITEXCNC_WALLCLOCK_WINDOW_SIZE - 1) % LITEXCNC_WALLCLOCK_WINDOW_SIZE;
+    litexcnc_wallclock_sample_t *origin = &estimator->window[oldest];
+    double x[LITEXCNC_WALLCLOCK_WINDOW_SIZE];
+    double y[LITEXCNC_WALLCLOCK_WINDOW_SIZE];
+    double intercept = 0, slope = 0, limit = INFINITY;
+
+    for (size_t i=0; i<estimator->window_filled; i++) {
+        x[i] = (double) (estimator->window[i].ticks - origin->ticks);
+        y[i] = (double) (estimator->window[i].host_ns - origin->host_ns) - x[i] * estimator->nominal_ns_per_tick;
+    }
+    for (size_t pass=0; pass<2; pass++) {
+        double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (size_t i=0; i<estimator->window_filled; i++) {
+            if (fabs(y[i] - intercept - slope * x[i]) > limit) {
+                continue;
+            }
+            n++;
+            sx += x[i];
+            sy += y[i];
+            sxx += x[i] * x[i];
+            sxy += x[i] * y[i];
+        }
+        double denominator = n * sxx - sx * sx;
+        if ((n < 2) || (denominator <= 0)) {
+            break;
+        }
+        slope = (n * sxy - sx * sy) / denominator;
+        intercept = (sy - slope * sx) / n;
+        // Determine the spread of the residuals for the second pass
+        double sum_squares = 0;
+        for (size_t i=0; i<estimator->window_filled; i++) {
+            double residual = y[i] - intercept - slope * x[i];
+            sum_squares += residual * residual;
+        }
+        limit = LITEXCNC_WALLCLOCK_OUTLIER_SIGMA * sqrt(sum_squares / estimator->window_filled);
+    }
+
+    // Move the reference of the model to the newest sample
+    double dx = (double) (estimator->window[newest].ticks - origin->ticks);
+    estimator->ns_per_tick = estimator->nominal_ns_per_tick + slope;
+    estimator->ticks_ref = estimator->window[newest].ticks;
+    estimator->host_ns_ref = origin->host_ns + (int64_t) (dx * estimator->ns_per_tick + intercept);
+}
+
+/**
+ * Adds a pair of the wall clock and the moment the host received it to the estimate
+ * of the relation between the clocks.
+ */
+static void litexcnc_wallclock_estimate(litexcnc_t *litexcnc, uint64_t ticks, int64_t host_ns) {
+    litexcnc_wallclock_t *wallclock = litexcnc->wallclock;
+    litexcnc_wallclock_estimator_t *estimator = &wallclock->estimator;
+    double nominal_ns_per_tick = 1e9 / litexcnc->clock_frequency;
+
+    // The first sample only gives the offset, the FPGA is assumed to run at its
+    // nominal frequency until the drift has been determined
+    if (!estimator->valid || (ticks < estimator->ticks_ref)) {
+        litexcnc_wallclock_restart(estimator, nominal_ns_per_tick, ticks, host_ns);
+    }
+    double residual = (double) (host_ns - litexcnc_wallclock_ticks_to_host_ns(litexcnc, ticks));
+    if (fabs(residual) > LITEXCNC_WALLCLOCK_RESTART_NS) {
+        litexcnc_wallclock_restart(estimator, nominal_ns_per_tick, ticks, host_ns);
+        residual = 0;
+    }
+
+    // Jitter, the spread of the residuals of all samples
+    double deviation = residual - estimator->residual_mean;
+    estimator->residual_mean += LITEXCNC_WALLCLOCK_JITTER_WEIGHT * deviation;
+    estimator->residual_variance += LITEXCNC_WALLCLOCK_JITTER_WEIGHT * (deviation * deviation - estimator->residual_variance);
+
+    // Keep the sample with the least delay of the block. At the end of the block this
+    // sample is added to the window and the model is fitted again.
+    if ((estimator->block_count == 0) || (residual < estimator->block_best_residual)) {
+        estimator->block_best.ticks = ticks;
+        estimator->block_best.host_ns = host_ns;
+        estimator->block_best_residual = residual;
+    }
+    estimator->block_count++;
+    if (estimator->block_count == LITEXCNC_WALLCLOCK_BLOCK_SIZE) {
+        estimator->window[estimator->window_index] = estimator->block_best;
+        estimator->window_index = (estimator->window_index + 1) % LITEXCNC_WALLCLOCK_WINDOW_SIZE;
+        if (estimator->window_filled < LITEXCNC_WALLCLOCK_WINDOW_SIZE) {
+            estimator->window_filled++;
+        }
+        estimator->block_count = 0;
+        litexcnc_wallclock_fit(estimator);
+    }
+
+    // Update the HAL pins
+    *(wallclock->hal.pin.offset_s) = (estimator->host_ns_ref - estimator->ticks_ref * estimator->ns_per_tick) * 1e-9;
+    *(wallclock->hal.pin.drift_ppm) = (estimator->nominal_ns_per_tick / estimator->ns_per_tick - 1.0) * 1e6;
+    *(wallclock->hal.pin.jitter_ns) = sqrt(estimator->residual_variance);
+    *(wallclock->hal.pin.locked) = estimator->window_filled >= LITEXCNC_WALLCLOCK_LOCK_BLOCKS;
+
+    // Skew with the first board, based on the estimated moments both boards sampled their
+    // data. The boards are not necessarily processed in the same order in each cycle, so
+    // the skew is taken relative to the nearest cycle of the first board.
+    if ((reference_board != NULL) && (reference_board != litexcnc) && reference_board->wallclock->estimator.valid) {
+        int64_t skew = 
+            litexcnc_wallclock_ticks_to_host_ns(litexcnc, ticks) -
+            litexcnc_wallclock_ticks_to_host_ns(reference_board, reference_board->wallclock->memo.wallclock_ticks);
+        if (litexcnc->fpga->period > 0) {
+            skew %= litexcnc->fpga->period;
+            if (skew > litexcnc->fpga->period / 2) {
+                skew -= litexcnc->fpga->period;
+            } else if (skew < -litexcnc->fpga->period / 2) {
+                skew += litexcnc->fpga->period;
+            }
+        }
+        *(wallclock->hal.pin.skew_ns) = skew;
+    }
+}
+
 uint8_t litexcnc_wallclock_process_read(litexcnc_t *litexcnc, uint8_t** data) {
 
     static uint64_t ticks;
@@ -87,7 +245,15 @@ uint8_t litexcnc_wallclock_process_read(litexcnc_t *litexcnc, uint8_t** data) {
 
     // Get the full value (fool-proof way ;) )
     memcpy(&ticks , *data, sizeof ticks);
-    litexcnc->wallclock->memo.wallclock_ticks = be64toh(ticks);
+    ticks = be64toh(ticks);
+    // Store the time elapsed since the previous read, which is used to determine the age
+    // of the data when the read data lags behind (pipelined or combined transfers)
+    if (litexcnc->wallclock->memo.wallclock_ticks && (ticks > litexcnc->wallclock->memo.wallclock_ticks)) {
+        litexcnc->wallclock->memo.wallclock_ticks_delta = ticks - litexcnc->wallclock->memo.wallclock_ticks;
+    }
+    litexcnc->wallclock->memo.wallclock_ticks = ticks;
+    litexcnc->wallclock->memo.timestamp_ns = litexcnc->read_timestamp_ns;
+    litexcnc_wallclock_estimate(litexcnc, ticks, litexcnc->read_timestamp_ns);
     // Write the MSB value to the HAL pins
     memcpy(&msb, *data, sizeof msb);
     *(litexcnc->wallclock->hal.pin.wallclock_ticks_msb) = be32toh(msb);
@@ -101,3 +267,53 @@ uint8_t litexcnc_wallclock_process_read(litexcnc_t *litexcnc, uint8_t** data) {
 }
 
 
+void litexcnc_wallclock_process_missed_read(litexcnc_t *litexcnc, long period) {
+    // The wall clock is advanced with the nominal length of a period, so modules which
+    // extrapolate their feedback see the time progress. The HAL pins and the estimate
+    // only reflect the values read from the FPGA.
+    if (!litexcnc->wallclock->memo.wallclock_ticks) {
+        return;
+    }
+    litexcnc->wallclock->memo.wallclock_ticks += (uint64_t) ((double) period * 1e-9 * litexcnc->clock_frequency);
+    litexcnc->wallclock->memo.timestamp_ns += period;
+}
+
+
+int64_t litexcnc_wallclock_host_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_wallclock_ticks_to_host_ns);
+int64_t litexcnc_wallclock_ticks_to_host_ns(litexcnc_t *litexcnc, uint64_t ticks) {
+    litexcnc_wallclock_estimator_t *estimator = &litexcnc->wallclock->estimator;
+    if (!estimator->valid) {
+        return 0;
+    }
+    // The difference is signed, so moments before the reference can be converted as well
+    double delta = (double) (int64_t) (ticks - estimator->ticks_ref);
+    return estimator->host_ns_ref + (int64_t) (delta * estimator->ns_per_tick);
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_wallclock_host_ns_to_ticks);
+uint64_t litexcnc_wallclock_host_ns_to_ticks(litexcnc_t *litexcnc, int64_t host_ns) {
+    litexcnc_wallclock_estimator_t *estimator = &litexcnc->wallclock->estimator;
+    if (!estimator->valid) {
+        return litexcnc->wallclock->memo.wallclock_ticks;
+    }
+    double delta = (double) (host_ns - estimator->host_ns_ref);
+    return estimator->ticks_ref + (int64_t) (delta / estimator->ns_per_tick);
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_wallclock_predict_write_ticks);
+uint64_t litexcnc_wallclock_predict_write_ticks(litexcnc_t *litexcnc) {
+    // The data written now arrives at the FPGA after the latency reported by the
+    // transport (zero when unknown)
+    return litexcnc_wallclock_host_ns_to_ticks(
+        litexcnc,
+        litexcnc_wallclock_host_ns() + litexcnc->fpga->write_latency_ns);
+}
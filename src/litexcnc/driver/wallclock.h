@@ -37,6 +37,48 @@
 #ifndef __INCLUDE_LITEXCNC_WALLCLOCK_H__
 #define __INCLUDE_LITEXCNC_WALLCLOCK_H__
 
+// Estimator of the relation between the wall clock of the FPGA and the clock of the
+// host (CLOCK_MONOTONIC). The delay of a sample is always positive, so of each block
+// of samples only the sample with the least delay is used. A straight line is fitted
+// through the window of these samples, which gives the offset and drift of the clock.
+// - number of samples in a block
+#define LITEXCNC_WALLCLOCK_BLOCK_SIZE 64
+// - number of blocks in the window of the fit
+#define LITEXCNC_WALLCLOCK_WINDOW_SIZE 64
+// - number of blocks required before the estimate is considered locked
+#define LITEXCNC_WALLCLOCK_LOCK_BLOCKS 8
+// - blocks deviating more than this number of standard deviations are not used in the fit
+#define LITEXCNC_WALLCLOCK_OUTLIER_SIGMA 3.0
+// - weight of a new sample in the estimate of the jitter
+#define LITEXCNC_WALLCLOCK_JITTER_WEIGHT (1.0 / 256)
+// - samples deviating more than this (in ns) restart the estimator (i.e. FPGA reset)
+#define LITEXCNC_WALLCLOCK_RESTART_NS 10000000
+
+typedef struct {
+    uint64_t ticks;
+    int64_t host_ns;
+} litexcnc_wallclock_sample_t;
+
+typedef struct {
+    // The model: host_ns = host_ns_ref + (ticks - ticks_ref) * ns_per_tick
+    bool valid;
+    uint64_t ticks_ref;
+    int64_t host_ns_ref;
+    double ns_per_tick;
+    double nominal_ns_per_tick;
+    // The sample with the least delay in the current block
+    litexcnc_wallclock_sample_t block_best;
+    double block_best_residual;
+    size_t block_count;
+    // The window of the best samples of the last blocks
+    litexcnc_wallclock_sample_t window[LITEXCNC_WALLCLOCK_WINDOW_SIZE];
+    size_t window_index;
+    size_t window_filled;
+    // Running mean and variance of the residuals of all samples
+    double residual_mean;
+    double residual_variance;
+} litexcnc_wallclock_estimator_t;
+
 // Defines the Watchdog. In contrast to the other components, the watchdog is
 // a singleton: exactly one exist on each FPGA-card
 typedef struct {
@@ -45,6 +87,11 @@ typedef struct {
         struct {
             hal_u32_t *wallclock_ticks_msb;  /* The most significant 4 bytes of the wall clock */
             hal_u32_t *wallclock_ticks_lsb;  /* The least significant 4 bytes of the wall clock */
+            hal_float_t *offset_s;           /* Moment (host clock, s) at which the wall clock was zero */
+            hal_float_t *drift_ppm;          /* Deviation of the clock of the FPGA from its nominal frequency, relative to the host */
+            hal_u32_t *jitter_ns;            /* Standard deviation of the moments the data is sampled, relative to the estimate */
+            hal_bit_t *locked;               /* The estimate is based on enough samples to be used */
+            hal_s32_t *skew_ns;              /* Moment this board sampled its data, relative to the first board */
         } pin;
 
         struct {
@@ -56,8 +103,12 @@ typedef struct {
     // This struct holds all old values (memoization) 
     struct {
         uint64_t wallclock_ticks; /* Combined MSB + LSB, should be in sync with the hal pins */
+        uint64_t wallclock_ticks_delta; /* Number of ticks between the two last reads */
+        int64_t timestamp_ns; /* Moment on the host the ticks were sampled (see read_timestamp_ns) */
     } memo;
 
+    litexcnc_wallclock_estimator_t estimator;
+
 } litexcnc_wallclock_t;
 
 // - write 
@@ -77,5 +128,11 @@ int litexcnc_wallclock_init(litexcnc_t *litexcnc);
 uint8_t litexcnc_wallclock_config(litexcnc_t *litexcnc, uint8_t **data, long period);
 uint8_t litexcnc_wallclock_prepare_write(litexcnc_t *litexcnc, uint8_t **data);
 uint8_t litexcnc_wallclock_process_read(litexcnc_t *litexcnc, uint8_t** data);
+void litexcnc_wallclock_process_missed_read(litexcnc_t *litexcnc, long period);
+// Functions for converting between the wall clock of the FPGA and the clock of the host
+int64_t litexcnc_wallclock_host_ns(void);
+int64_t litexcnc_wallclock_ticks_to_host_ns(litexcnc_t *litexcnc, uint64_t ticks);
+uint64_t litexcnc_wallclock_host_ns_to_ticks(litexcnc_t *litexcnc, int64_t host_ns);
+uint64_t litexcnc_wallclock_predict_write_ticks(litexcnc_t *litexcnc);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,158 @@
+from contextlib import contextmanager
+
+from migen import *
+
+from litex.soc.interconnect import stream
+
 from ..boards.colorlight import ColorLightBase
 from ..boards.rv901t import RV901T
 
+
+class EtherboneBurstRecordReceiver(Module):
+    """
+    Record receiver for the Etherbone core of LiteEth, with support for burst reads. It
+    replaces the default record receiver of LiteEth and handles normal records in the
+    same way.
+
+    A burst read is indicated with the flag ``rca`` in the record. Instead of an address
+    for each word to read, the record only contains the base return address followed
+    by a single address. The receiver reads ``rcount`` consecutive words, starting at
+    this address. The response is the same as for a normal read. This halves the size
+    of the read request, which is then always 20 bytes (one record).
+    """
+    def __init__(self, buffer_depth=4):
+        from liteeth.common import eth_etherbone_record_description, eth_etherbone_mmap_description
+
+        self.sink   = sink   = stream.Endpoint(eth_etherbone_record_description(32))
+        self.source = source = stream.Endpoint(eth_etherbone_mmap_description(32))
+
+        # # #
+
+        assert buffer_depth <= 256
+
+        # Receive FIFO
+        self.submodules.fifo = fifo = stream.SyncFIFO(eth_etherbone_record_description(32), buffer_depth, buffered=True)
+        self.comb += sink.connect(fifo.sink)
+
+        # Receive FSM
+        base_addr = Signal(32, reset_less=True)
+        base_addr_update = Signal()
+        self.sync += If(base_addr_update, base_addr.eq(fifo.source.data))
+        # - the header of the record is only valid as long as there is data in the FIFO,
+        #   for burst reads it is stored
+        burst_addr  = Signal(30, reset_less=True)
+        burst_count = Signal(8, reset_less=True)
+        burst_be    = Signal(4, reset_less=True)
+
+        count = Signal(8, reset_less=True)
+
+        self.submodules.fsm = fsm = FSM(reset_state="IDLE")
+        fsm.act("IDLE",
+            fifo.source.ready.eq(1),
+            NextValue(count, 0),
+            If(fifo.source.valid,
+                base_addr_update.eq(1),
+                If(fifo.source.wcount,
+                    NextState("RECEIVE_WRITES")
+                ).Elif(fifo.source.rcount,
+                    If(fifo.source.rca,
+                        NextState("RECEIVE_BURST_ADDR")
+                    ).Else(
+                        NextState("RECEIVE_READS")
+                    )
+                )
+            )
+        )
+        fsm.act("RECEIVE_WRITES",
+            source.valid.eq(fifo.source.valid),
+            source.last.eq(count == fifo.source.wcount-1),
+            source.count.eq(fifo.source.wcount),
+            source.be.eq(fifo.source.byte_enable),
+            source.addr.eq(base_addr[2:] + count),
+            source.we.eq(1),
+            source.data.eq(fifo.source.data),
+            fifo.source.ready.eq(source.ready),
+            If(source.valid & source.ready,
+                NextValue(count, count + 1),
+                If(source.last,
+                    If(fifo.source.rcount,
+                        NextState("RECEIVE_BASE_RET_ADDR")
+                    ).Else(
+                        NextState("IDLE")
+                    )
+                )
+            )
+        )
+        fsm.act("RECEIVE_BASE_RET_ADDR",
+            NextValue(count, 0),
+            fifo.source.ready.eq(1),
+            If(fifo.source.valid,
+                base_addr_update.eq(1),
+                If(fifo.source.rca,
+                    NextState("RECEIVE_BURST_ADDR")
+                ).Else(
+                    NextState("RECEIVE_READS")
+                )
+            )
+        )
+        fsm.act("RECEIVE_READS",
+            source.valid.eq(fifo.source.valid),
+            source.last.eq(count == fifo.source.rcount-1),
+            source.count.eq(fifo.source.rcount),
+            source.base_addr.eq(base_addr),
+            source.be.eq(fifo.source.byte_enable),
+            source.addr.eq(fifo.source.data[2:]),
+            fifo.source.ready.eq(source.ready),
+            If(source.valid & source.ready,
+                NextValue(count, count + 1),
+                If(source.last,
+                    NextState("IDLE")
+                )
+            )
+        )
+        fsm.act("RECEIVE_BURST_ADDR",
+            fifo.source.ready.eq(1),
+            If(fifo.source.valid,
+                NextValue(burst_addr, fifo.source.data[2:]),
+                NextValue(burst_count, fifo.source.rcount),
+                NextValue(burst_be, fifo.source.byte_enable),
+                NextState("SEND_BURST_READS")
+            )
+        )
+        fsm.act("SEND_BURST_READS",
+            source.valid.eq(1),
+            source.last.eq(count == burst_count-1),
+            source.count.eq(burst_count),
+            source.base_addr.eq(base_addr),
+            source.be.eq(burst_be),
+            source.addr.eq(burst_addr + count),
+            If(source.valid & source.ready,
+                NextValue(count, count + 1),
+                If(source.last,
+                    NextState("IDLE")
+                )
+            )
+        )
+
+
+@contextmanager
+def _record_receiver(burst_read):
+    """
+    Replaces the record receiver of LiteEth with the receiver supporting burst reads
+    while the Etherbone core is created.
+    """
+    if not burst_read:
+        yield
+        return
+    import liteeth.frontend.etherbone as etherbone
+    original = etherbone.LiteEthEtherboneRecordReceiver
+    etherbone.LiteEthEtherboneRecordReceiver = EtherboneBurstRecordReceiver
+    try:
+        yield
+    finally:
+        etherbone.LiteEthEtherboneRecordReceiver = original
+
+
 def _add_etherbone_colorlight(soc, connection):
     
     from liteeth.phy.ecp5rgmii import LiteEthPHYRGMII
@@ -14,13 +166,14 @@ def _add_etherbone_colorlight(soc, connection):
            and key in ['tx_delay', 'rx_delay', 'with_hw_init_reset']
         }
     )
-    soc.add_etherbone(
-        phy=soc.ethphy,
-        mac_address=connection.mac_address,
-        ip_address=str(connection.ip_address),
-        buffer_depth=255,
-        data_width=32
-    )
+    with _record_receiver(connection.burst_read):
+        soc.add_etherbone(
+            phy=soc.ethphy,
+            mac_address=connection.mac_address,
+            ip_address=str(connection.ip_address),
+            buffer_depth=connection.buffer_depth,
+            data_width=32
+        )
 
 def _add_etherbone_rv901t(soc, connection):
     from liteeth.phy.s6rgmii import LiteEthPHYRGMII
@@ -36,13 +189,14 @@ def _add_etherbone_rv901t(soc, connection):
         }
     )
     soc.submodules += soc.ethphy
-    soc.add_etherbone(
-        phy=soc.ethphy,
-        mac_address=connection.mac_address,
-        ip_address=str(connection.ip_address),
-        buffer_depth=255,
-        data_width=32
-    )
+    with _record_receiver(connection.burst_read):
+        soc.add_etherbone(
+            phy=soc.ethphy,
+            mac_address=connection.mac_address,
+            ip_address=str(connection.ip_address),
+            buffer_depth=connection.buffer_depth,
+            data_width=32
+        )
 
     # Timing constraints
     soc.platform.add_period_constraint(soc.ethphy.crg.cd_eth_rx.clk, 1e9/125e6)
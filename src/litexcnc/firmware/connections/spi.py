@@ -120,6 +120,13 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
     CPU's icache is empty, responses can take many thousands of cycles.
 
     The bridge core is designed to run at 1/4 the system clock.
+
+    When the bridge is created with ``with_crc``, a command can be protected with
+    a CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) by setting bit 31 of
+    its address. The CRC covers the command, the address and the data. A write
+    sends the CRC after the data; the words are buffered and only written to the
+    bus when the CRC is correct, otherwise the write is not acknowledged and the
+    previous values remain. A read is followed by the CRC of the returned data.
     """
     COMMAND_BITS   = 2
     COMMAND_READ   = 0x1
@@ -127,10 +134,12 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
     SIZE_BITS      = 6
     ADDRESS_WIDTH  = 4
     VALUE_WIDTH    = 4 
+    CRC_WIDTH      = 2
+    CRC_POLYNOMIAL = 0x1021
+    CRC_INIT       = 0xFFFF
+    MAX_WORDS      = 31
 
-
-
-    def __init__(self, pads, wires=4, with_tristate=True, debug_led=None):
+    def __init__(self, pads, wires=4, with_tristate=True, debug_led=None, with_crc=False):
         self.wishbone = wishbone.Interface()
 
         # # #
@@ -141,6 +150,8 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
             self.mod_doc = Spi3WireDocumentation()
         elif wires == 2:
             self.mod_doc = Spi2WireDocumentation()
+        if with_crc and wires == 2:
+            raise ValueError("CRC is not supported by the 2-wire protocol")
 
         clk  = Signal()
         cs_n = Signal()
@@ -158,6 +169,11 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
         value     = Signal(32)
         wr        = Signal()
         sync_byte = Signal(8)
+        crc       = Signal(16, reset=self.CRC_INIT)
+        crc_offset = Signal(4)
+        crc_enabled = Signal()
+        index     = Signal(5)
+        buffered_value = Signal(32)
 
         self.specials += [
             MultiReg(pads.clk, clk),
@@ -200,9 +216,16 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
         if debug_led is not None:
             self.comb += debug_led[0].eq(cs_n)
 
-        # Connect the Wishbone bus up to our values
+        # Connect the Wishbone bus up to our values. Bit 31 of the address requests
+        # a CRC when it is supported.
+        if with_crc:
+            self.comb += [
+                crc_enabled.eq(address[31]),
+                self.wishbone.adr.eq(address[2:31]),
+            ]
+        else:
+            self.comb += self.wishbone.adr.eq(address[2:])
         self.comb += [
-            self.wishbone.adr.eq(address[2:]),
             self.wishbone.dat_w.eq(value),
             self.wishbone.sel.eq(2**len(self.wishbone.sel) - 1)
         ]
@@ -210,7 +233,49 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
         # Constantly have the counter increase, except when it's reset
         # in the IDLE state
         self.sync += If(cs_n, counter.eq(0)).Elif(clk_rising, counter.eq(counter + 1))
-        self.sync += If(cs_n, counter2.eq(0))
+        self.sync += If(cs_n, counter2.eq(0), index.eq(0))
+
+        # The CRC is calculated over all bits received from the host, up to and
+        # including the CRC of a write, and over the data returned by a read. The
+        # residue of a correctly received write is zero.
+        if with_crc:
+            crc_bit = Signal()
+            crc_next = Signal(16)
+            crc_shifted = Signal(16)
+            receiving = Signal()
+            transmitting = Signal()
+            self.comb += [
+                receiving.eq(
+                    fsm.ongoing("IDLE") |
+                    fsm.ongoing("GET_COMMAND") |
+                    fsm.ongoing("READ_NUM_BYTES") |
+                    fsm.ongoing("READ_ADDRESS") |
+                    fsm.ongoing("READ_VALUE") |
+                    fsm.ongoing("READ_CRC")
+                ),
+                transmitting.eq(fsm.ongoing("WRITE_VALUE")),
+                crc_bit.eq(Mux(transmitting, (value >> write_offset)[0], mosi)),
+                crc_shifted.eq(Cat(0, crc[:15])),
+                crc_next.eq(Mux(crc[15] ^ crc_bit, crc_shifted ^ self.CRC_POLYNOMIAL, crc_shifted)),
+            ]
+            self.sync += If(cs_n,
+                crc.eq(self.CRC_INIT)
+            ).Elif((receiving & clk_rising) | (transmitting & clk_falling),
+                crc.eq(crc_next)
+            )
+
+            # Writes with a CRC are buffered until the CRC has been checked
+            storage = Memory(32, self.MAX_WORDS + 1)
+            storage_write = storage.get_port(write_capable=True)
+            storage_read = storage.get_port(async_read=True)
+            self.specials += storage, storage_write, storage_read
+            self.comb += [
+                storage_write.adr.eq(index),
+                storage_write.dat_w.eq(value),
+                storage_write.we.eq(fsm.ongoing("READ_VALUE") & crc_enabled & (counter2 == self.VALUE_WIDTH * 8)),
+                storage_read.adr.eq(index),
+                buffered_value.eq(storage_read.dat_r),
+            ]
 
         if wires == 2:
             fsm.act("IDLE",
@@ -287,7 +352,16 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
         fsm.act("READ_VALUE",
             miso_en.eq(0),
             If(counter2 == self.VALUE_WIDTH * 8,
-                NextState("WRITE_WISHBONE"),
+                If(crc_enabled,
+                    # The value is stored in the buffer, see above
+                    NextValue(index, index + 1),
+                    NextValue(counter2, 0),
+                    If(index == num_words - 1,
+                        NextState("READ_CRC"),
+                    ),
+                ).Else(
+                    NextState("WRITE_WISHBONE"),
+                ),
             ),
             If(clk_rising,
                 NextValue(counter2, counter2 + 1),
@@ -313,6 +387,47 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
             ),
         )
 
+        # Receive the CRC of a write, the buffered words are only written when
+        # the CRC is correct. A rejected write is not acknowledged.
+        fsm.act("READ_CRC",
+            miso_en.eq(0),
+            If(counter2 == self.CRC_WIDTH * 8,
+                If(crc == 0,
+                    NextValue(index, 0),
+                    NextState("LOAD_BUFFERED"),
+                ).Else(
+                    NextState("END"),
+                ),
+            ),
+            If(clk_rising,
+                NextValue(counter2, counter2 + 1),
+            ),
+        )
+
+        fsm.act("LOAD_BUFFERED",
+            miso_en.eq(1),
+            NextValue(value, buffered_value),
+            NextState("WRITE_BUFFERED"),
+        )
+
+        fsm.act("WRITE_BUFFERED",
+            self.wishbone.stb.eq(1),
+            self.wishbone.we.eq(1),
+            self.wishbone.cyc.eq(1),
+            miso_en.eq(1),
+            If(self.wishbone.ack | self.wishbone.err,
+                NextValue(num_words, num_words - 1),
+                If(
+                    num_words == 1,  # NOTE: the updating of num_bytes is not sequential, it happens in the next loop
+                    NextState("CHECK_BYTE_BOUNDARY")
+                ).Else(
+                    NextValue(address, address + self.ADDRESS_WIDTH),
+                    NextValue(index, index + 1),
+                    NextState("LOAD_BUFFERED")
+                )
+            ),
+        )
+
         fsm.act("READ_WISHBONE",
             self.wishbone.stb.eq(1),
             self.wishbone.we.eq(0),
@@ -391,7 +506,12 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
                     If(
                         num_words == 1,  # NOTE: the updating of num_bytes is not sequential, it happens in the next loop
                         NextValue(miso, 0),
-                        NextState("END")
+                        If(crc_enabled,
+                            NextValue(crc_offset, self.CRC_WIDTH * 8 - 1),
+                            NextState("WRITE_CRC")
+                        ).Else(
+                            NextState("END")
+                        )
                     ).Else(
                         NextValue(address, address + self.ADDRESS_WIDTH),
                         NextState("READ_WISHBONE")
@@ -400,6 +520,19 @@ class SpiWishboneBridge(Module, ModuleDoc, AutoDoc):
             ),
         )
 
+        # Write the CRC of the data of a read
+        fsm.act("WRITE_CRC",
+            miso_en.eq(1),
+            NextValue(miso, crc >> crc_offset),
+            If(clk_falling,
+                NextValue(crc_offset, crc_offset - 1),
+                If(crc_offset == 0,
+                    NextValue(miso, 0),
+                    NextState("END")
+                ),
+            ),
+        )
+
         if wires == 3 or wires == 4:
             fsm.act("END",
                 NextValue(miso, 1),
@@ -439,7 +572,7 @@ def add_spi(soc, connection):
     # soc.platform.add_period_constraint(soc.spi_cd.clk, 1e9/125e6)
     # soc.platform.add_false_path_constraints(soc.crg.cd_sys.clk, soc.spi_cd.clk)
 
-    soc.submodules.spibone = ClockDomainsRenamer("clk_125")(SpiWishboneBridge(spi_pads, debug_led=soc.platform.request("user_led_n")))
+    soc.submodules.spibone = ClockDomainsRenamer("clk_125")(SpiWishboneBridge(spi_pads, debug_led=soc.platform.request("user_led_n"), with_crc=connection.crc))
     soc.add_wb_master(soc.spibone.wishbone)
 
 
@@ -0,0 +1,11 @@
+"""
+Userspace emulator of a FPGA running the LitexCNC firmware with an Etherbone connection.
+The emulator makes it possible to run and benchmark the driver without hardware.
+"""
+from .fpga import EmulatedFPGA
+from .server import EtherboneServer
+
+__all__ = [
+    'EmulatedFPGA',
+    'EtherboneServer'
+]
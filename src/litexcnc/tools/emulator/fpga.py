@@ -0,0 +1,135 @@
+"""
+Emulation of the memory of a FPGA running the LitexCNC firmware. The memory has the
+same layout as the driver derives in ``litexcnc_register``:
+
+- header: magic, version, clock frequency, module config and the name of the board;
+- module config: for each module the module id and its configuration data;
+- reset: the reset flag;
+- config: the configuration of the modules, written by the driver at start-up;
+- write: watchdog and the data of the modules;
+- read: watchdog, wall-clock and the data of the modules.
+"""
+import time
+
+from packaging.version import Version
+
+from litexcnc.firmware import __version__
+from .modules import (
+    WatchdogModel,
+    GPIOModel,
+    PWMModel,
+    EncoderModel,
+    StepgenModel
+)
+
+MAGIC = 0x18052022
+HEADER_SIZE = 32
+RESET_SIZE = 4
+WALLCLOCK_SIZE = 8
+
+
+class EmulatedFPGA:
+    """
+    Memory of the FPGA. The wall-clock is derived from the monotonic clock of the host,
+    the modules are advanced each time the memory is accessed.
+    """
+
+    def __init__(self, config, gpio_loopback=False):
+        self.config = config
+        self.clock_frequency = int(config.clock_frequency)
+        self.watchdog = WatchdogModel(config.watchdog)
+        self.modules = []
+        for module in config.modules:
+            if module.module_type == 'gpio':
+                self.modules.append(GPIOModel(module, loopback=gpio_loopback))
+            elif module.module_type == 'pwm':
+                self.modules.append(PWMModel(module))
+            elif module.module_type == 'encoder':
+                self.modules.append(EncoderModel(module))
+            elif module.module_type == 'stepgen':
+                self.modules.append(StepgenModel(module, self.clock_frequency, self.watchdog))
+            else:
+                raise TypeError(f"Module type `{module.module_type}` is not supported by the emulator.")
+
+        # Determine the layout of the memory
+        module_config = b''.join(
+            model.module_id.to_bytes(4, 'big') + model.config_data
+            for model in self.modules
+        )
+        self.reset_address = HEADER_SIZE + len(module_config)
+        self.config_address = self.reset_address + RESET_SIZE
+        self.write_address = self.config_address + sum(model.config_size for model in self.modules)
+        self.read_address = self.write_address + self.watchdog.write_size + sum(model.write_size for model in self.modules)
+        self.size = self.read_address + self.watchdog.read_size + WALLCLOCK_SIZE + sum(model.read_size for model in self.modules)
+        self.memory = bytearray(self.size)
+
+        # Header
+        version = Version(__version__)
+        header = bytearray(HEADER_SIZE)
+        header[0:4] = MAGIC.to_bytes(4, 'big')
+        header[4:8] = bytes([0, version.major, version.minor, version.micro])
+        header[8:12] = self.clock_frequency.to_bytes(4, 'big')
+        header[12:16] = bytes([0, len(self.modules)]) + len(module_config).to_bytes(2, 'big')
+        header[16:32] = config.board_name.ljust(16, '\0')[0:16].encode('ascii')
+        self.memory[0:HEADER_SIZE] = header
+        self.memory[HEADER_SIZE:self.reset_address] = module_config
+
+        self.start = time.monotonic_ns()
+        self.cycle = 0
+
+    def wallclock(self):
+        """Returns the wall-clock of the FPGA, in clock cycles since the start."""
+        return (time.monotonic_ns() - self.start) * self.clock_frequency // 1000000000
+
+    def advance(self):
+        """Advances all modules to the current wall-clock."""
+        cycle = self.wallclock()
+        if self.in_reset:
+            for model in [self.watchdog] + self.modules:
+                model.reset()
+        else:
+            for model in self.modules:
+                model.advance(self.cycle, cycle)
+        self.cycle = cycle
+
+    @property
+    def in_reset(self):
+        return bool(int.from_bytes(self.memory[self.reset_address:self.reset_address+4], 'big') & 0x01)
+
+    def write(self, address, values):
+        """Writes the words to consecutive addresses. Writes outside the memory and to
+        read-only registers are ignored."""
+        self.advance()
+        end = address + 4 * len(values)
+        for index, value in enumerate(values):
+            word = address + 4 * index
+            if self.reset_address <= word < self.read_address:
+                self.memory[word:word+4] = value.to_bytes(4, 'big')
+        # Inform the modules of which the registers have been written
+        start = self.write_address
+        for model in [self.watchdog] + self.modules:
+            if model.write_size and address < start + model.write_size and end > start:
+                model.write(memoryview(self.memory)[start:start+model.write_size], self.cycle)
+            start += model.write_size
+        if self.in_reset:
+            self.advance()
+            # The firmware clears the watchdog while in reset
+            self.memory[self.write_address:self.write_address+4] = bytes(4)
+
+    def read(self, addresses):
+        """Returns the words at the given addresses."""
+        self.advance()
+        # Update the read region
+        view = memoryview(self.memory)
+        start = self.read_address
+        self.watchdog.read(view[start:start+4], self.cycle)
+        start += self.watchdog.read_size
+        view[start:start+WALLCLOCK_SIZE] = self.cycle.to_bytes(WALLCLOCK_SIZE, 'big')
+        start += WALLCLOCK_SIZE
+        for model in self.modules:
+            model.read(view[start:start+model.read_size], self.cycle)
+            start += model.read_size
+        return [
+            int.from_bytes(self.memory[address:address+4], 'big') if 0 <= address <= self.size - 4 else 0
+            for address in addresses
+        ]
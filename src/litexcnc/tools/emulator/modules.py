@@ -0,0 +1,320 @@
+"""
+Models of the modules of the LitexCNC firmware, as used by the emulator. Each model
+describes the registers of the module in the same order and size as the driver expects
+them and mimics the behaviour of the firmware on these registers. The models are not
+cycle-accurate, they are meant to make the driver behave as if it is connected to a
+real FPGA.
+
+The registers are stored big-endian, like the CSRs of LiteX: a register which spans
+multiple words has its most significant word at the lowest address.
+"""
+import math
+
+
+def _dwords(count):
+    """Returns the number of bytes required to store ``count`` bits in DWORDS."""
+    return int(math.ceil(float(count) / 32)) * 4
+
+
+def _to_signed(value, bits):
+    """Converts an unsigned value to a signed value of the given number of bits."""
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value & (1 << (bits - 1)) else value
+
+
+class EmulatedModule:
+    """
+    Base-class for the model of a module. The sizes are in bytes. The memory passed to
+    the functions is a ``memoryview`` on the region of the module.
+    """
+    module_id = 0
+
+    def __init__(self, config):
+        self.config = config
+
+    @property
+    def config_data(self) -> bytes:
+        """The data which identifies the module in the header of the FPGA, excluding
+        the module id."""
+        return b''
+
+    @property
+    def config_size(self) -> int:
+        """The size of the configuration written by the driver at start-up."""
+        return 0
+
+    @property
+    def write_size(self) -> int:
+        return 0
+
+    @property
+    def read_size(self) -> int:
+        return 0
+
+    def reset(self):
+        """Called while the reset flag of the FPGA is raised."""
+
+    def write(self, data: memoryview, cycle: int):
+        """Called after the driver has written to the write region of the module."""
+
+    def read(self, data: memoryview, cycle: int):
+        """Called before the driver reads the read region of the module."""
+
+    def advance(self, start: int, end: int):
+        """Advances the state of the module from clock cycle ``start`` to ``end``."""
+
+
+class WatchdogModel(EmulatedModule):
+    """
+    The watchdog bites when the timeout (bit 30 - 0 of the watchdog data) has passed
+    since the last time it has been written while it was enabled (bit 31).
+    """
+    def __init__(self, config):
+        super().__init__(config)
+        self.enabled = False
+        self.bite_cycle = 0
+        self.bitten = False
+
+    @property
+    def write_size(self):
+        return 4
+
+    @property
+    def read_size(self):
+        return 4
+
+    def reset(self):
+        self.enabled = False
+        self.bitten = False
+
+    def write(self, data, cycle):
+        value = int.from_bytes(data[0:4], 'big')
+        self.enabled = bool(value & 0x80000000)
+        self.bite_cycle = cycle + (value & 0x7FFFFFFF)
+
+    def has_bitten(self, cycle):
+        return self.enabled and cycle >= self.bite_cycle
+
+    def read(self, data, cycle):
+        data[0:4] = int(self.has_bitten(cycle)).to_bytes(4, 'big')
+
+
+class GPIOModel(EmulatedModule):
+    """
+    The outputs are stored, the inputs are either zero or a copy of the outputs when
+    ``loopback`` is set (the first input reflects the first output, etc.).
+    """
+    module_id = 0x6770696f
+
+    def __init__(self, config, loopback=False):
+        super().__init__(config)
+        self.num_outputs = sum(1 for instance in config.instances if instance.direction == "out")
+        self.num_inputs = sum(1 for instance in config.instances if instance.direction == "in")
+        self.loopback = loopback
+        self.outputs = 0
+
+    @property
+    def config_data(self):
+        size = _dwords(len(self.config.instances) + 16)
+        config = 0
+        for index, instance in enumerate(self.config.instances):
+            if instance.direction == "out":
+                config |= (1 << index)
+        config += self.num_outputs << (size * 8 - 8)
+        config += self.num_inputs << (size * 8 - 16)
+        return config.to_bytes(size, 'big')
+
+    @property
+    def write_size(self):
+        return _dwords(self.num_outputs)
+
+    @property
+    def read_size(self):
+        return _dwords(self.num_inputs)
+
+    def reset(self):
+        self.outputs = 0
+
+    def write(self, data, cycle):
+        self.outputs = int.from_bytes(data, 'big')
+
+    def read(self, data, cycle):
+        inputs = self.outputs if self.loopback else 0
+        data[:] = (inputs & ((1 << (self.read_size * 8)) - 1)).to_bytes(self.read_size, 'big')
+
+
+class PWMModel(EmulatedModule):
+    """
+    The PWM only stores the enable flags, periods and widths.
+    """
+    module_id = 0x70776d5f
+
+    def __init__(self, config):
+        super().__init__(config)
+        self.enable = 0
+        self.period = [0] * len(config.instances)
+        self.width = [0] * len(config.instances)
+
+    @property
+    def config_data(self):
+        return len(self.config.instances).to_bytes(4, 'big')
+
+    @property
+    def write_size(self):
+        return _dwords(len(self.config.instances)) + 8 * len(self.config.instances)
+
+    def write(self, data, cycle):
+        offset = _dwords(len(self.config.instances))
+        self.enable = int.from_bytes(data[0:offset], 'big')
+        for index in range(len(self.config.instances)):
+            self.period[index] = int.from_bytes(data[offset:offset+4], 'big')
+            self.width[index] = int.from_bytes(data[offset+4:offset+8], 'big')
+            offset += 8
+
+
+class EncoderModel(EmulatedModule):
+    """
+    There are no encoder signals in the emulator, so the counters stay at their reset
+    value. The index pulse is never set.
+    """
+    module_id = 0x656e635f
+
+    def __init__(self, config):
+        super().__init__(config)
+        self.counters = [instance.reset_value for instance in config.instances]
+
+    @property
+    def config_data(self):
+        return len(self.config.instances).to_bytes(4, 'big')
+
+    @property
+    def write_size(self):
+        # Index enable and reset index pulse
+        return 2 * _dwords(len(self.config.instances))
+
+    @property
+    def read_size(self):
+        # Index pulse and the counters
+        return _dwords(len(self.config.instances)) + 4 * len(self.config.instances)
+
+    def reset(self):
+        self.counters = [instance.reset_value for instance in self.config.instances]
+
+    def read(self, data, cycle):
+        offset = _dwords(len(self.config.instances))
+        data[0:offset] = bytes(offset)
+        for counter in self.counters:
+            data[offset:offset+4] = (counter & 0xFFFFFFFF).to_bytes(4, 'big')
+            offset += 4
+
+
+class StepgenModel(EmulatedModule):
+    """
+    Fixed point model of the stepgen. The speed has 8 more fractional bits than the
+    register, the position ``shift`` more bits than the register, with ``shift``
+    determined from the clock frequency as in the firmware. The speed target and the
+    maximum acceleration are applied once the wall-clock has passed the apply time.
+    When the watchdog has bitten, the stepgen decelerates to stand-still (soft stop) or
+    stops immediately.
+
+    NOTE: the driver writes the timings of each stepgen in the config region, so the
+    model reserves a DWORD per stepgen for the timings.
+    """
+    module_id = 0x73746570
+    SPEED_ZERO = 0x80000000
+
+    def __init__(self, config, clock_frequency, watchdog):
+        super().__init__(config)
+        self.watchdog = watchdog
+        self.shift = 0
+        while clock_frequency / (1 << (self.shift + 1)) > 400e3:
+            self.shift += 1
+        self.apply_time = 0
+        self.speed_target_reg = [self.SPEED_ZERO] * len(config.instances)
+        self.acceleration_reg = [0] * len(config.instances)
+        self.reset()
+
+    @property
+    def config_data(self):
+        return len(self.config.instances).to_bytes(4, 'big')
+
+    @property
+    def config_size(self):
+        return 4 * len(self.config.instances)
+
+    @property
+    def write_size(self):
+        if not self.config.instances:
+            return 0
+        return 8 + 8 * len(self.config.instances)
+
+    @property
+    def read_size(self):
+        return 12 * len(self.config.instances)
+
+    def reset(self):
+        count = len(self.config.instances)
+        self.position = [0] * count
+        self.speed = [self.SPEED_ZERO << 8] * count
+        self.speed_target = [self.SPEED_ZERO << 8] * count
+        self.acceleration = [0] * count
+        self.apply_time = 0x80000000
+
+    def write(self, data, cycle):
+        self.apply_time = int.from_bytes(data[0:8], 'big')
+        offset = 8
+        for index in range(len(self.config.instances)):
+            self.speed_target_reg[index] = int.from_bytes(data[offset:offset+4], 'big')
+            self.acceleration_reg[index] = int.from_bytes(data[offset+4:offset+8], 'big')
+            offset += 8
+
+    def read(self, data, cycle):
+        offset = 0
+        for index in range(len(self.config.instances)):
+            position = (self.position[index] >> self.shift) & 0xFFFFFFFFFFFFFFFF
+            data[offset:offset+8] = position.to_bytes(8, 'big')
+            data[offset+8:offset+12] = (self.speed[index] >> 8).to_bytes(4, 'big')
+            offset += 12
+
+    def advance(self, start, end):
+        # Split the interval at the moments the behaviour changes
+        moments = [end]
+        if start < self.apply_time < end:
+            moments.append(self.apply_time)
+        if self.watchdog.enabled and start < self.watchdog.bite_cycle < end:
+            moments.append(self.watchdog.bite_cycle)
+        for moment in sorted(moments):
+            self._advance(start, moment)
+            start = moment
+
+    def _advance(self, start, end):
+        cycles = end - start
+        if cycles <= 0:
+            return
+        enabled = not self.watchdog.has_bitten(start)
+        if start >= self.apply_time:
+            for index in range(len(self.config.instances)):
+                self.speed_target[index] = self.speed_target_reg[index] << 8
+                self.acceleration[index] = self.acceleration_reg[index]
+        for index, instance in enumerate(self.config.instances):
+            target = self.speed_target[index] if enabled else self.SPEED_ZERO << 8
+            if not enabled and not instance.soft_stop:
+                # Position is not updated when disabled without soft stop
+                self.speed[index] = target
+                continue
+            speed = self.speed[index]
+            acceleration = self.acceleration[index]
+            if acceleration == 0 or speed == target:
+                ramp, speed_end = 0, target
+            else:
+                ramp = min(cycles, -(-abs(target - speed) // acceleration))
+                direction = 1 if target > speed else -1
+                speed_end = speed + direction * ramp * acceleration
+                if ramp < cycles or (direction * (speed_end - target)) > 0:
+                    speed_end = target
+                # Integrate the position over the ramp (trapezoid)
+                self.position[index] += (ramp * speed + direction * acceleration * ramp * (ramp - 1) // 2) >> 8
+                self.position[index] -= ramp * self.SPEED_ZERO
+            self.position[index] += (cycles - ramp) * ((speed_end >> 8) - self.SPEED_ZERO)
+            self.position[index] = _to_signed(self.position[index], 64 + self.shift)
+            self.speed[index] = speed_end
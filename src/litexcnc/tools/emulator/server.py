@@ -0,0 +1,111 @@
+"""
+UDP server speaking the subset of the Etherbone protocol used by the driver (see
+``etherbone.h``): packets with one or more records, each with writes to consecutive
+addresses and/or reads, including the burst reads of the LitexCNC firmware. Like the
+Etherbone core of LiteEth, the responses are sent to the port of the server on the
+host which sent the request.
+
+For benchmarking, a latency (with jitter) can be added to the responses and a fraction
+of the responses can be dropped.
+"""
+import heapq
+import random
+import select
+import socket
+import struct
+import time
+
+MAGIC = 0x4e6f
+RECORD_FLAG_BURST_READ = 0x02
+
+
+class EtherboneServer:
+
+    def __init__(self, fpga, address='127.0.0.1', port=1234, reply_port=None,
+                 latency_us=0, jitter_us=0, loss=0.0, burst_read=False, seed=None):
+        self.fpga = fpga
+        self.reply_port = reply_port if reply_port else port
+        self.latency_ns = int(latency_us * 1000)
+        self.jitter_ns = int(jitter_us * 1000)
+        self.loss = loss
+        self.burst_read = burst_read
+        self.random = random.Random(seed)
+        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.socket.bind((address, port))
+        # Responses waiting for their injected latency: (time to send, counter, data, address)
+        self.pending = []
+        self.counter = 0
+        # Statistics
+        self.packets_received = 0
+        self.packets_sent = 0
+        self.packets_dropped = 0
+        self.packets_invalid = 0
+
+    def handle_packet(self, data):
+        """Executes the records in the packet and returns the response (or ``None`` when
+        the packet does not contain reads)."""
+        if len(data) < 8 or struct.unpack('>H', data[0:2])[0] != MAGIC:
+            self.packets_invalid += 1
+            return None
+        response = bytearray(data[0:8])
+        offset = 8
+        while offset + 4 <= len(data):
+            flags, byte_enable, wcount, rcount = data[offset:offset+4]
+            offset += 4
+            if wcount:
+                address, = struct.unpack('>I', data[offset:offset+4])
+                values = struct.unpack(f'>{wcount}I', data[offset+4:offset+4+4*wcount])
+                offset += 4 + 4 * wcount
+                self.fpga.write(address, values)
+            if rcount:
+                base_ret_address = data[offset:offset+4]
+                offset += 4
+                if self.burst_read and (flags & RECORD_FLAG_BURST_READ):
+                    address, = struct.unpack('>I', data[offset:offset+4])
+                    addresses = [address + 4 * index for index in range(rcount)]
+                    offset += 4
+                else:
+                    addresses = struct.unpack(f'>{rcount}I', data[offset:offset+4*rcount])
+                    offset += 4 * rcount
+                values = self.fpga.read(addresses)
+                # The response is a write to the base return address
+                response += bytes([0, byte_enable, rcount, 0]) + base_ret_address
+                response += struct.pack(f'>{rcount}I', *values)
+        if len(response) == 8:
+            return None
+        return bytes(response)
+
+    def _send(self, data, address):
+        self.socket.sendto(data, (address, self.reply_port))
+        self.packets_sent += 1
+
+    def serve(self, duration=None):
+        """Serves requests until interrupted (or ``duration`` seconds have passed)."""
+        end = time.monotonic() + duration if duration else None
+        while end is None or time.monotonic() < end:
+            # Wait for a request or the first response to be sent
+            timeout = 0.1
+            if self.pending:
+                timeout = max(0, (self.pending[0][0] - time.monotonic_ns()) / 1e9)
+            readable, _, _ = select.select([self.socket], [], [], timeout)
+            if readable:
+                data, (address, _) = self.socket.recvfrom(65536)
+                self.packets_received += 1
+                response = self.handle_packet(data)
+                if response is not None:
+                    if self.loss and self.random.random() < self.loss:
+                        self.packets_dropped += 1
+                    elif self.latency_ns or self.jitter_ns:
+                        delay = self.latency_ns + self.random.randint(0, self.jitter_ns)
+                        self.counter += 1
+                        heapq.heappush(self.pending, (time.monotonic_ns() + delay, self.counter, response, address))
+                    else:
+                        self._send(response, address)
+            # Send the responses of which the latency has passed
+            now = time.monotonic_ns()
+            while self.pending and self.pending[0][0] <= now:
+                _, _, response, address = heapq.heappop(self.pending)
+                self._send(response, address)
+
+    def close(self):
+        self.socket.close()
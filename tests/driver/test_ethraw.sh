@@ -0,0 +1,78 @@
+#!/bin/bash
+# This script tests the raw Ethernet connection (ethraw) without hardware. The firmware is
+# emulated in a separate network namespace, which is reached from the host by a veth-pair.
+# The MAC-address of the emulated board is set to the one in the json-configuration, which
+# is located in the ../../examples folder. After the driver has been running for a while,
+# the statistics of the connection are checked. Requires root (for creating the network
+# namespace and the raw socket) and an installed LinuxCNC and LitexCNC.
+#
+# USAGE:
+#    sudo ./test_ethraw.sh [<path-to-json-configuration>] [<board-name>] [<mac-address>]
+set -u
+
+CONFIG=${1:-$(dirname "$0")/../../examples/5a-75e_simple.json}
+BOARD=${2:-simple_5a-75a}
+MAC=${3:-10:e2:d5:00:00:00}
+NETNS=litexcnc-emu
+EMULATOR_PID=
+FAILED=0
+
+cleanup() {
+    halrun -U > /dev/null 2>&1
+    if [ -n "$EMULATOR_PID" ]; then
+        kill -INT "$EMULATOR_PID" 2> /dev/null
+        wait "$EMULATOR_PID" 2> /dev/null
+    fi
+    ip link del veth0 2> /dev/null
+    ip netns del "$NETNS" 2> /dev/null
+}
+trap cleanup EXIT
+
+getp() {
+    halcmd getp "$BOARD.$1"
+}
+
+check() {
+    if eval "$2"; then
+        echo "PASS: $1"
+    else
+        echo "FAIL: $1 ($2)"
+        FAILED=1
+    fi
+}
+
+# Network: the host is 10.0.0.1 on veth0, the emulated board 10.0.0.10 on veth1
+ip netns add "$NETNS" || exit 1
+ip link add veth0 type veth peer name veth1 netns "$NETNS" || exit 1
+ip addr add 10.0.0.1/24 dev veth0
+ip link set veth0 up
+ip -n "$NETNS" link set veth1 address "$MAC" || exit 1
+ip -n "$NETNS" addr add 10.0.0.10/24 dev veth1
+ip -n "$NETNS" link set veth1 up
+ip -n "$NETNS" link set lo up
+
+ip netns exec "$NETNS" litexcnc emulate_firmware "$CONFIG" --address 0.0.0.0 &
+EMULATOR_PID=$!
+sleep 2
+
+# Driver, with the raw connection and a thread of 1 ms
+realtime start || exit 1
+halcmd loadrt litexcnc "connections=ethraw:veth0,$MAC?ip=10.0.0.10" || exit 1
+halcmd loadrt threads name1=test-thread period1=1000000
+halcmd addf "$BOARD.read" test-thread
+halcmd addf "$BOARD.write" test-thread
+halcmd start
+sleep 3
+
+SENT=$(getp packets_sent)
+RECEIVED=$(getp packets_received)
+check "packets are sent" "[ $SENT -gt 1000 ]"
+check "responses are received" "[ $RECEIVED -gt 1000 ]"
+check "hardly any responses are dropped" "[ $(getp packets_dropped) -lt 10 ]"
+check "no frames failed to send" "[ $(getp send_errors) -eq 0 ]"
+sleep 1
+check "responses are still received" "[ $(getp packets_received) -gt $((RECEIVED + 900)) ]"
+check "the watchdog has not bitten" "[ $(halcmd getp $BOARD.watchdog.has_bitten) = FALSE ]"
+
+halcmd show pin "$BOARD.packets"
+exit $FAILED
@@ -0,0 +1,101 @@
+#!/bin/bash
+# This script tests the redundant links of the Ethernet connection without hardware. The
+# firmware is emulated in a separate network namespace, which is reached from the host by
+# two veth-pairs. After both links have been running for a while, one of the links is taken
+# down and the statistics of the links are checked. The json-configuration is located in
+# the ../../examples folder. Requires root (for creating the network namespace) and an
+# installed LinuxCNC and LitexCNC.
+#
+# USAGE:
+#    sudo ./test_redundant_links.sh [<path-to-json-configuration>] [<board-name>]
+set -u
+
+CONFIG=${1:-$(dirname "$0")/../../examples/5a-75e_simple.json}
+BOARD=${2:-simple_5a-75a}
+NETNS=litexcnc-emu
+EMULATOR_PID=
+FAILED=0
+
+cleanup() {
+    halrun -U > /dev/null 2>&1
+    if [ -n "$EMULATOR_PID" ]; then
+        kill -INT "$EMULATOR_PID" 2> /dev/null
+        wait "$EMULATOR_PID" 2> /dev/null
+    fi
+    ip link del veth-a0 2> /dev/null
+    ip link del veth-b0 2> /dev/null
+    ip netns del "$NETNS" 2> /dev/null
+}
+trap cleanup EXIT
+
+getp() {
+    halcmd getp "$BOARD.$1"
+}
+
+check() {
+    if eval "$2"; then
+        echo "PASS: $1"
+    else
+        echo "FAIL: $1 ($2)"
+        FAILED=1
+    fi
+}
+
+# Network: link 0 is 10.0.0.0/24, link 1 is 10.0.1.0/24. The emulator listens on both
+# addresses in the namespace.
+ip netns add "$NETNS" || exit 1
+ip link add veth-a0 type veth peer name veth-a1 netns "$NETNS" || exit 1
+ip link add veth-b0 type veth peer name veth-b1 netns "$NETNS" || exit 1
+ip addr add 10.0.0.1/24 dev veth-a0
+ip addr add 10.0.1.1/24 dev veth-b0
+ip link set veth-a0 up
+ip link set veth-b0 up
+ip -n "$NETNS" addr add 10.0.0.10/24 dev veth-a1
+ip -n "$NETNS" addr add 10.0.1.10/24 dev veth-b1
+ip -n "$NETNS" link set veth-a1 up
+ip -n "$NETNS" link set veth-b1 up
+ip -n "$NETNS" link set lo up
+
+ip netns exec "$NETNS" litexcnc emulate_firmware "$CONFIG" --address 0.0.0.0 &
+EMULATOR_PID=$!
+sleep 2
+
+# Driver, with both links and a thread of 1 ms
+realtime start || exit 1
+halcmd loadrt litexcnc "connections=eth:10.0.0.10|10.0.1.10" || exit 1
+halcmd loadrt threads name1=test-thread period1=1000000
+halcmd addf "$BOARD.read" test-thread
+halcmd addf "$BOARD.write" test-thread
+halcmd start
+sleep 3
+
+# Both links up: each packet is sent on both links, but counted once for the board
+SENT=$(getp packets_sent)
+SENT_0=$(getp link.0.packets_sent)
+SENT_1=$(getp link.1.packets_sent)
+RECEIVED_0=$(getp link.0.packets_received)
+RECEIVED_1=$(getp link.1.packets_received)
+check "packets are sent" "[ $SENT -gt 1000 ]"
+check "packets are counted once for the board" "[ $((SENT * 3)) -lt $(((SENT_0 + SENT_1) * 2)) ]"
+check "responses are received on link 0" "[ $RECEIVED_0 -gt 1000 ]"
+check "responses are received on link 1" "[ $RECEIVED_1 -gt 1000 ]"
+check "no responses are lost on link 1" "[ $(getp link.1.packets_lost) -lt 10 ]"
+
+# Link 1 down: the board keeps running on link 0
+ip link set veth-b0 down
+LOST_1=$(getp link.1.packets_lost)
+BOARD_RECEIVED=$(getp packets_received)
+sleep 3
+RECEIVED_1_DOWN=$(getp link.1.packets_received)
+FIRST_1_DOWN=$(getp link.1.responses_first)
+sleep 1
+check "responses are still received on link 0" "[ $(getp link.0.packets_received) -gt $((RECEIVED_0 + 3000)) ]"
+check "no responses are received on link 1" "[ $(getp link.1.packets_received) -eq $RECEIVED_1_DOWN ]"
+check "responses are lost on link 1" "[ $(getp link.1.packets_lost) -gt $((LOST_1 + 900)) ]"
+check "responses are still received by the board" "[ $(getp packets_received) -gt $((BOARD_RECEIVED + 3000)) ]"
+check "responses are used from link 0 only" "[ $(getp link.1.responses_first) -eq $FIRST_1_DOWN ]"
+check "the watchdog has not bitten" "[ $(halcmd getp $BOARD.watchdog.has_bitten) = FALSE ]"
+
+halcmd show pin "$BOARD.link"
+halcmd show pin "$BOARD.packets"
+exit $FAILED